@@ -0,0 +1,578 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+// Arbitrary precision signed integer.
+// The magnitude is stored as little endian 32 bit limbs with no leading zero limbs, so zero has no limbs.
+class BigInt
+{
+public:
+    typedef std::vector<uint32_t> Limbs;
+
+    BigInt() {}
+
+    BigInt(int64_t value)
+    {
+        negative = value < 0;
+        uint64_t magnitude = negative ? (~uint64_t(value) + 1) : uint64_t(value);
+        SetMagnitude(magnitude);
+    }
+
+    static BigInt FromUInt64(uint64_t value)
+    {
+        BigInt ret;
+        ret.SetMagnitude(value);
+        return ret;
+    }
+
+    // makes the exact integer value of a double. The fractional part is dropped.
+    static BigInt FromDouble(double value)
+    {
+        BigInt ret;
+        bool isNegative = value < 0.0;
+        value = std::floor(std::abs(value));
+        int exponent = 0;
+        double mantissa = std::frexp(value, &exponent);
+        if (exponent <= 0)
+            return ret;
+        ret = FromUInt64(uint64_t(std::ldexp(mantissa, 53)));
+        ret = exponent >= 53 ? (ret << (exponent - 53)) : (ret >> (53 - exponent));
+        if (isNegative)
+            ret = -ret;
+        return ret;
+    }
+
+    bool IsZero() const { return limbs.empty(); }
+    bool IsNegative() const { return negative; }
+    int Sign() const { return IsZero() ? 0 : (negative ? -1 : 1); }
+    const Limbs& GetLimbs() const { return limbs; }
+
+    void swap(BigInt& other)
+    {
+        limbs.swap(other.limbs);
+        std::swap(negative, other.negative);
+    }
+
+    size_t BitLength() const
+    {
+        if (limbs.empty())
+            return 0;
+        size_t bits = (limbs.size() - 1) * 32;
+        for (uint32_t top = limbs.back(); top != 0; top >>= 1)
+            bits++;
+        return bits;
+    }
+
+    // returns false if the value is negative or doesn't fit
+    bool ToUInt64(uint64_t& value) const
+    {
+        if (negative || limbs.size() > 2)
+            return false;
+        value = 0;
+        for (size_t index = limbs.size(); index-- > 0; )
+            value = (value << 32) | limbs[index];
+        return true;
+    }
+
+    // returns false if the value doesn't fit
+    bool ToInt64(int64_t& value) const
+    {
+        uint64_t magnitude = 0;
+        if (limbs.size() > 2)
+            return false;
+        for (size_t index = limbs.size(); index-- > 0; )
+            magnitude = (magnitude << 32) | limbs[index];
+        if (magnitude > (negative ? uint64_t(INT64_MAX) + 1 : uint64_t(INT64_MAX)))
+            return false;
+        value = negative ? int64_t(~magnitude + 1) : int64_t(magnitude);
+        return true;
+    }
+
+    double ToDouble() const
+    {
+        // only the top 3 limbs can affect the result
+        double ret = 0.0;
+        size_t lowest = limbs.size() > 3 ? limbs.size() - 3 : 0;
+        for (size_t index = limbs.size(); index-- > lowest; )
+            ret = ret * 4294967296.0 + double(limbs[index]);
+        ret = std::ldexp(ret, int(lowest * 32));
+        return negative ? -ret : ret;
+    }
+
+    std::string ToString() const
+    {
+        if (limbs.empty())
+            return "0";
+
+        // peel off 9 decimal digits at a time
+        std::vector<uint32_t> chunks;
+        Limbs magnitude = limbs;
+        while (!magnitude.empty())
+            chunks.push_back(DivModSmallMagnitude(magnitude, 1000000000, magnitude));
+
+        std::string ret = negative ? "-" : "";
+        ret += std::to_string(chunks.back());
+        for (size_t index = chunks.size() - 1; index-- > 0; )
+        {
+            std::string digits = std::to_string(chunks[index]);
+            ret.append(9 - digits.size(), '0');
+            ret += digits;
+        }
+        return ret;
+    }
+
+    // ---------------------------------------------------------------------------
+    // comparison
+
+    static int Compare(const BigInt& a, const BigInt& b)
+    {
+        if (a.negative != b.negative)
+            return a.negative ? -1 : 1;
+        int magnitude = CompareMagnitude(a.limbs, b.limbs);
+        return a.negative ? -magnitude : magnitude;
+    }
+
+    friend bool operator == (const BigInt& a, const BigInt& b) { return a.negative == b.negative && a.limbs == b.limbs; }
+    friend bool operator != (const BigInt& a, const BigInt& b) { return !(a == b); }
+    friend bool operator < (const BigInt& a, const BigInt& b) { return Compare(a, b) < 0; }
+    friend bool operator > (const BigInt& a, const BigInt& b) { return Compare(a, b) > 0; }
+    friend bool operator <= (const BigInt& a, const BigInt& b) { return Compare(a, b) <= 0; }
+    friend bool operator >= (const BigInt& a, const BigInt& b) { return Compare(a, b) >= 0; }
+
+    // ---------------------------------------------------------------------------
+    // arithmetic. Division truncates towards zero like the built in integer types, see FloorDivMod for flooring.
+
+    BigInt operator - () const
+    {
+        BigInt ret = *this;
+        if (!ret.IsZero())
+            ret.negative = !ret.negative;
+        return ret;
+    }
+
+    friend BigInt operator + (const BigInt& a, const BigInt& b)
+    {
+        BigInt ret;
+        AddSigned(a, b, b.negative, ret);
+        return ret;
+    }
+
+    friend BigInt operator - (const BigInt& a, const BigInt& b)
+    {
+        BigInt ret;
+        AddSigned(a, b, !b.negative, ret);
+        return ret;
+    }
+
+    friend BigInt operator * (const BigInt& a, const BigInt& b)
+    {
+        BigInt ret;
+        MulMagnitude(a.limbs, b.limbs, ret.limbs);
+        ret.negative = !ret.limbs.empty() && (a.negative != b.negative);
+        return ret;
+    }
+
+    friend BigInt operator / (const BigInt& a, const BigInt& b)
+    {
+        BigInt quotient, remainder;
+        DivMod(a, b, quotient, remainder);
+        return quotient;
+    }
+
+    friend BigInt operator % (const BigInt& a, const BigInt& b)
+    {
+        BigInt quotient, remainder;
+        DivMod(a, b, quotient, remainder);
+        return remainder;
+    }
+
+    // shifts move the magnitude and keep the sign
+    friend BigInt operator << (const BigInt& a, size_t bits)
+    {
+        BigInt ret;
+        ShiftLeftMagnitude(a.limbs, bits, ret.limbs);
+        ret.negative = a.negative && !ret.limbs.empty();
+        return ret;
+    }
+
+    friend BigInt operator >> (const BigInt& a, size_t bits)
+    {
+        BigInt ret;
+        ShiftRightMagnitude(a.limbs, bits, ret.limbs);
+        ret.negative = a.negative && !ret.limbs.empty();
+        return ret;
+    }
+
+    BigInt& operator += (const BigInt& b) { AddSigned(*this, b, b.negative, *this); return *this; }
+    BigInt& operator -= (const BigInt& b) { AddSigned(*this, b, !b.negative, *this); return *this; }
+    BigInt& operator *= (const BigInt& b) { *this = *this * b; return *this; }
+    BigInt& operator /= (const BigInt& b) { *this = *this / b; return *this; }
+    BigInt& operator %= (const BigInt& b) { *this = *this % b; return *this; }
+    BigInt& operator <<= (size_t bits) { *this = *this << bits; return *this; }
+    BigInt& operator >>= (size_t bits) { *this = *this >> bits; return *this; }
+
+    // this = this * multiplier + addend, without making temporaries
+    void MulAddSmall(uint32_t multiplier, uint32_t addend)
+    {
+        uint64_t carry = addend;
+        for (uint32_t& limb : limbs)
+        {
+            uint64_t value = uint64_t(limb) * multiplier + carry;
+            limb = uint32_t(value);
+            carry = value >> 32;
+        }
+        if (carry)
+            limbs.push_back(uint32_t(carry));
+        Trim();
+    }
+
+    // x * multiplier for a multiplier that fits in 32 bits plus a sign
+    static BigInt MulSmall(const BigInt& x, int64_t multiplier)
+    {
+        BigInt ret = x;
+        bool multiplierNegative = multiplier < 0;
+        ret.MulAddSmall(uint32_t(multiplierNegative ? -multiplier : multiplier), 0);
+        ret.negative = !ret.limbs.empty() && (x.negative != multiplierNegative);
+        return ret;
+    }
+
+    // divides the magnitude in place and returns the remainder of the magnitude
+    uint32_t DivModSmall(uint32_t divisor)
+    {
+        uint32_t remainder = DivModSmallMagnitude(limbs, divisor, limbs);
+        if (limbs.empty())
+            negative = false;
+        return remainder;
+    }
+
+    // truncating division, remainder has the sign of a. b must not be zero.
+    static void DivMod(const BigInt& a, const BigInt& b, BigInt& quotient, BigInt& remainder)
+    {
+        bool quotientNegative = a.negative != b.negative;
+        bool remainderNegative = a.negative;
+        DivModMagnitude(a.limbs, b.limbs, quotient.limbs, remainder.limbs);
+        quotient.negative = quotientNegative && !quotient.limbs.empty();
+        remainder.negative = remainderNegative && !remainder.limbs.empty();
+    }
+
+    // flooring division, remainder has the sign of b. b must not be zero.
+    static void FloorDivMod(const BigInt& a, const BigInt& b, BigInt& quotient, BigInt& remainder)
+    {
+        BigInt divisor = b;
+        DivMod(a, divisor, quotient, remainder);
+        if (!remainder.IsZero() && (remainder.negative != divisor.negative))
+        {
+            quotient -= BigInt(1);
+            remainder += divisor;
+        }
+    }
+
+    static BigInt FloorDiv(const BigInt& a, const BigInt& b)
+    {
+        BigInt quotient, remainder;
+        FloorDivMod(a, b, quotient, remainder);
+        return quotient;
+    }
+
+    static BigInt Abs(const BigInt& a)
+    {
+        BigInt ret = a;
+        ret.negative = false;
+        return ret;
+    }
+
+    // floor(sqrt(a)) for a >= 0, using Newton's method
+    static BigInt Sqrt(const BigInt& a)
+    {
+        if (a.Sign() <= 0)
+            return BigInt();
+
+        // start above the answer, then Newton's method decreases monotonically to it
+        BigInt x = BigInt(1) << ((a.BitLength() + 1) / 2);
+        while (true)
+        {
+            BigInt y = (x + a / x) >> 1;
+            if (y >= x)
+                return x;
+            x = y;
+        }
+    }
+
+private:
+    void SetMagnitude(uint64_t magnitude)
+    {
+        limbs.clear();
+        while (magnitude)
+        {
+            limbs.push_back(uint32_t(magnitude));
+            magnitude >>= 32;
+        }
+        if (limbs.empty())
+            negative = false;
+    }
+
+    void Trim()
+    {
+        TrimLimbs(limbs);
+        if (limbs.empty())
+            negative = false;
+    }
+
+    static void TrimLimbs(Limbs& a)
+    {
+        while (!a.empty() && a.back() == 0)
+            a.pop_back();
+    }
+
+    static int CompareMagnitude(const Limbs& a, const Limbs& b)
+    {
+        if (a.size() != b.size())
+            return a.size() < b.size() ? -1 : 1;
+        for (size_t index = a.size(); index-- > 0; )
+        {
+            if (a[index] != b[index])
+                return a[index] < b[index] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    // out = a + (bNegative ? -|b| : |b|). out may alias a.
+    static void AddSigned(const BigInt& a, const BigInt& b, bool bNegative, BigInt& out)
+    {
+        if (a.negative == bNegative)
+        {
+            AddMagnitude(a.limbs, b.limbs, out.limbs);
+            out.negative = bNegative && !out.limbs.empty();
+            return;
+        }
+
+        int compare = CompareMagnitude(a.limbs, b.limbs);
+        if (compare == 0)
+        {
+            out.limbs.clear();
+            out.negative = false;
+        }
+        else if (compare > 0)
+        {
+            bool negative = a.negative;
+            SubMagnitude(a.limbs, b.limbs, out.limbs);
+            out.negative = negative;
+        }
+        else
+        {
+            SubMagnitude(b.limbs, a.limbs, out.limbs);
+            out.negative = bNegative;
+        }
+    }
+
+    // out = a + b. out may alias a or b.
+    static void AddMagnitude(const Limbs& a, const Limbs& b, Limbs& out)
+    {
+        const Limbs& longer = a.size() >= b.size() ? a : b;
+        const Limbs& shorter = a.size() >= b.size() ? b : a;
+        size_t shortSize = shorter.size();
+        size_t longSize = longer.size();
+        out.resize(longSize);
+        uint64_t carry = 0;
+        for (size_t index = 0; index < longSize; ++index)
+        {
+            uint64_t sum = uint64_t(longer[index]) + (index < shortSize ? shorter[index] : 0) + carry;
+            out[index] = uint32_t(sum);
+            carry = sum >> 32;
+        }
+        if (carry)
+            out.push_back(uint32_t(carry));
+    }
+
+    // out = a - b, where a >= b. out may alias a or b.
+    static void SubMagnitude(const Limbs& a, const Limbs& b, Limbs& out)
+    {
+        size_t bSize = b.size();
+        size_t aSize = a.size();
+        out.resize(aSize);
+        int64_t borrow = 0;
+        for (size_t index = 0; index < aSize; ++index)
+        {
+            int64_t difference = int64_t(a[index]) - (index < bSize ? int64_t(b[index]) : 0) - borrow;
+            borrow = difference < 0 ? 1 : 0;
+            out[index] = uint32_t(difference + (borrow << 32));
+        }
+        TrimLimbs(out);
+    }
+
+    static void MulMagnitude(const Limbs& a, const Limbs& b, Limbs& out)
+    {
+        if (a.empty() || b.empty())
+        {
+            out.clear();
+            return;
+        }
+
+        Limbs result(a.size() + b.size(), 0);
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            uint64_t carry = 0;
+            uint64_t ai = a[i];
+            for (size_t j = 0; j < b.size(); ++j)
+            {
+                uint64_t value = ai * b[j] + result[i + j] + carry;
+                result[i + j] = uint32_t(value);
+                carry = value >> 32;
+            }
+            result[i + b.size()] = uint32_t(carry);
+        }
+        TrimLimbs(result);
+        out.swap(result);
+    }
+
+    // quotient = a / divisor, returns a % divisor. quotient may alias a.
+    static uint32_t DivModSmallMagnitude(const Limbs& a, uint32_t divisor, Limbs& quotient)
+    {
+        quotient.resize(a.size());
+        uint64_t remainder = 0;
+        for (size_t index = a.size(); index-- > 0; )
+        {
+            uint64_t value = (remainder << 32) | a[index];
+            quotient[index] = uint32_t(value / divisor);
+            remainder = value % divisor;
+        }
+        TrimLimbs(quotient);
+        return uint32_t(remainder);
+    }
+
+    static void ShiftLeftMagnitude(const Limbs& a, size_t bits, Limbs& out)
+    {
+        if (a.empty())
+        {
+            out.clear();
+            return;
+        }
+        size_t limbShift = bits / 32;
+        unsigned int bitShift = unsigned(bits % 32);
+        Limbs result(a.size() + limbShift + 1, 0);
+        for (size_t index = 0; index < a.size(); ++index)
+        {
+            uint64_t value = uint64_t(a[index]) << bitShift;
+            result[index + limbShift] |= uint32_t(value);
+            result[index + limbShift + 1] |= uint32_t(value >> 32);
+        }
+        TrimLimbs(result);
+        out.swap(result);
+    }
+
+    static void ShiftRightMagnitude(const Limbs& a, size_t bits, Limbs& out)
+    {
+        size_t limbShift = bits / 32;
+        unsigned int bitShift = unsigned(bits % 32);
+        if (limbShift >= a.size())
+        {
+            out.clear();
+            return;
+        }
+        Limbs result(a.size() - limbShift, 0);
+        for (size_t index = 0; index < result.size(); ++index)
+        {
+            uint64_t value = a[index + limbShift];
+            if (index + limbShift + 1 < a.size())
+                value |= uint64_t(a[index + limbShift + 1]) << 32;
+            result[index] = uint32_t(value >> bitShift);
+        }
+        TrimLimbs(result);
+        out.swap(result);
+    }
+
+    // Knuth's algorithm D, as laid out in Hacker's Delight (divmnu)
+    static void DivModMagnitude(const Limbs& a, const Limbs& b, Limbs& quotient, Limbs& remainder)
+    {
+        if (CompareMagnitude(a, b) < 0)
+        {
+            remainder = a;
+            quotient.clear();
+            return;
+        }
+
+        if (b.size() == 1)
+        {
+            uint32_t rem = DivModSmallMagnitude(a, b[0], quotient);
+            remainder.clear();
+            if (rem)
+                remainder.push_back(rem);
+            return;
+        }
+
+        // normalize so the top bit of the divisor is set
+        unsigned int shift = 0;
+        for (uint32_t top = b.back(); (top & 0x80000000u) == 0; top <<= 1)
+            shift++;
+
+        size_t n = b.size();
+        size_t m = a.size() - n;
+        Limbs vn(n), un(a.size() + 1);
+        for (size_t index = n - 1; index > 0; --index)
+            vn[index] = (b[index] << shift) | (shift ? (b[index - 1] >> (32 - shift)) : 0);
+        vn[0] = b[0] << shift;
+        un[a.size()] = shift ? (a.back() >> (32 - shift)) : 0;
+        for (size_t index = a.size() - 1; index > 0; --index)
+            un[index] = (a[index] << shift) | (shift ? (a[index - 1] >> (32 - shift)) : 0);
+        un[0] = a[0] << shift;
+
+        Limbs q(m + 1, 0);
+        const uint64_t c_base = uint64_t(1) << 32;
+        for (size_t j = m + 1; j-- > 0; )
+        {
+            // estimate the quotient digit from the top two limbs, then correct it
+            uint64_t numerator = (uint64_t(un[j + n]) << 32) | un[j + n - 1];
+            uint64_t qhat = numerator / vn[n - 1];
+            uint64_t rhat = numerator % vn[n - 1];
+            while (qhat >= c_base || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2]))
+            {
+                qhat--;
+                rhat += vn[n - 1];
+                if (rhat >= c_base)
+                    break;
+            }
+
+            // multiply and subtract
+            int64_t borrow = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                uint64_t product = qhat * vn[i];
+                int64_t t = int64_t(un[i + j]) - borrow - int64_t(product & 0xFFFFFFFFu);
+                un[i + j] = uint32_t(t);
+                borrow = int64_t(product >> 32) - (t >> 32);
+            }
+            int64_t t = int64_t(un[j + n]) - borrow;
+            un[j + n] = uint32_t(t);
+
+            // if we subtracted too much, add one divisor back
+            q[j] = uint32_t(qhat);
+            if (t < 0)
+            {
+                q[j]--;
+                uint64_t carry = 0;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    uint64_t sum = uint64_t(un[i + j]) + vn[i] + carry;
+                    un[i + j] = uint32_t(sum);
+                    carry = sum >> 32;
+                }
+                un[j + n] += uint32_t(carry);
+            }
+        }
+
+        // un now holds the normalized remainder
+        remainder.resize(n);
+        for (size_t index = 0; index < n; ++index)
+            remainder[index] = (un[index] >> shift) | (shift ? (un[index + 1] << (32 - shift)) : 0);
+        TrimLimbs(remainder);
+        TrimLimbs(q);
+        quotient.swap(q);
+    }
+
+    Limbs limbs;
+    bool negative = false;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <cstddef>
+#include <mutex>
+
+// Hands out blocks of memory, and keeps the blocks it is given back to hand out again instead of freeing them.
+// Sizes are rounded up to a power of 2, so code that allocates about the same sizes over and over, like encoding one
+// frame after another, stops touching the heap once it has freed a block of every size it uses. Thread safe.
+class BufferPool
+{
+public:
+    BufferPool() = default;
+
+    ~BufferPool()
+    {
+        for (Header*& freeList : freeLists)
+        {
+            while (freeList)
+            {
+                Header* next = freeList->next;
+                free(freeList);
+                freeList = next;
+            }
+        }
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    void* Allocate(size_t size)
+    {
+        int sizeClass = SizeClass(size);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Header* header = freeLists[sizeClass];
+            if (header)
+            {
+                freeLists[sizeClass] = header->next;
+                return header + 1;
+            }
+        }
+
+        Header* header = (Header*)malloc(sizeof(Header) + (size_t(1) << sizeClass));
+        if (!header)
+            return nullptr;
+        header->sizeClass = sizeClass;
+        return header + 1;
+    }
+
+    void* Reallocate(void* block, size_t size)
+    {
+        if (!block)
+            return Allocate(size);
+
+        // the block may already have room, since its size was rounded up
+        size_t capacity = size_t(1) << ((Header*)block - 1)->sizeClass;
+        if (size <= capacity)
+            return block;
+
+        void* newBlock = Allocate(size);
+        if (!newBlock)
+            return nullptr;
+        memcpy(newBlock, block, capacity);
+        Free(block);
+        return newBlock;
+    }
+
+    void Free(void* block)
+    {
+        if (!block)
+            return;
+
+        Header* header = (Header*)block - 1;
+        std::lock_guard<std::mutex> lock(mutex);
+        header->next = freeLists[header->sizeClass];
+        freeLists[header->sizeClass] = header;
+    }
+
+private:
+    // in front of every block. The size keeps the blocks after it aligned like malloc's.
+    struct alignas(alignof(std::max_align_t)) Header
+    {
+        Header* next;
+        int sizeClass;
+    };
+
+    static constexpr int c_minSizeClass = 6;
+    static constexpr int c_sizeClassCount = int(sizeof(size_t) * 8);
+
+    // the smallest power of 2 block that holds size bytes
+    static int SizeClass(size_t size)
+    {
+        int sizeClass = c_minSizeClass;
+        while (sizeClass < c_sizeClassCount - 1 && (size_t(1) << sizeClass) < size)
+            sizeClass++;
+        return sizeClass;
+    }
+
+    std::mutex mutex;
+    Header* freeLists[c_sizeClassCount] = {};
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+// Runtime checks for SIMD instruction sets, so that a build for a baseline x86 CPU can still pick faster code
+// paths on the machine it's running on. Functions using an instruction set are tagged with the TARGET_ macros,
+// which gcc and clang need to allow the intrinsics. MSVC allows them anywhere.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define CPU_X86 0
+#endif
+
+#if CPU_X86 && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+#if CPU_X86
+
+inline bool CPUSupportsSSE41()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 19)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+inline bool CPUSupportsAVX2()
+{
+#ifdef _MSC_VER
+    // the OS also has to save the AVX registers on context switches
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#else
+
+inline bool CPUSupportsSSE41() { return false; }
+inline bool CPUSupportsAVX2() { return false; }
+
+#endif
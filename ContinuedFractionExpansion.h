@@ -0,0 +1,655 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include "BigInt.h"
+
+// Exact continued fraction expansions, backed by BigInt.
+// Terms are made one at a time when asked for, so callers only pay for the terms they use.
+class ContinuedFractionExpansion
+{
+public:
+    virtual ~ContinuedFractionExpansion() {}
+
+    // Gets the next term. Returns false once the expansion has ended, which only happens for rational numbers.
+    virtual bool NextTerm(BigInt& term) = 0;
+
+    // gets up to count more terms
+    std::vector<BigInt> NextTerms(int count)
+    {
+        std::vector<BigInt> terms;
+        BigInt term;
+        while (int(terms.size()) < count && NextTerm(term))
+            terms.push_back(term);
+        return terms;
+    }
+};
+
+// numerator / denominator, expanded with the Euclidean algorithm
+class RationalExpansion : public ContinuedFractionExpansion
+{
+public:
+    RationalExpansion(const BigInt& numerator, const BigInt& denominator)
+        : numerator(numerator)
+        , denominator(denominator)
+    {
+    }
+
+    // the exact value of a double, which is always a rational number with a power of two denominator
+    static RationalExpansion FromDouble(double value)
+    {
+        int exponent = 0;
+        double mantissa = std::frexp(value, &exponent);
+        BigInt numerator = BigInt::FromDouble(std::ldexp(mantissa, 53));
+        exponent -= 53;
+        if (exponent >= 0)
+            return RationalExpansion(numerator << exponent, BigInt(1));
+        return RationalExpansion(numerator, BigInt(1) << size_t(-exponent));
+    }
+
+    bool NextTerm(BigInt& term) override
+    {
+        if (denominator.IsZero())
+            return false;
+
+        BigInt remainder;
+        BigInt::FloorDivMod(numerator, denominator, term, remainder);
+        numerator = denominator;
+        denominator = remainder;
+        return true;
+    }
+
+private:
+    BigInt numerator;
+    BigInt denominator;
+};
+
+// (p + sqrt(d)) / q, which has a periodic continued fraction when d is not a perfect square.
+class QuadraticSurdExpansion : public ContinuedFractionExpansion
+{
+public:
+    QuadraticSurdExpansion(const BigInt& p, const BigInt& d, const BigInt& q)
+        : p(p)
+        , d(d)
+        , q(q)
+    {
+        // the recurrence only stays in integers if q divides d - p^2. If it doesn't, scale everything by |q|.
+        if (!((this->d - this->p * this->p) % this->q).IsZero())
+        {
+            BigInt absQ = BigInt::Abs(this->q);
+            this->p *= absQ;
+            this->d *= this->q * this->q;
+            this->q *= absQ;
+        }
+
+        sqrtD = BigInt::Sqrt(this->d);
+        if (sqrtD * sqrtD == this->d)
+            rational.reset(new RationalExpansion(this->p + sqrtD, this->q));
+    }
+
+    bool NextTerm(BigInt& term) override
+    {
+        if (rational)
+            return rational->NextTerm(term);
+
+        // term = floor((p + sqrt(d)) / q). sqrt(d) is irrational, so which integer to round it to depends
+        // on the sign of q.
+        if (q.IsNegative())
+            term = BigInt::FloorDiv(p + sqrtD + BigInt(1), q);
+        else
+            term = BigInt::FloorDiv(p + sqrtD, q);
+
+        // 1 / (x - term) = (p' + sqrt(d)) / q'. the division is exact.
+        p = term * q - p;
+        q = (d - p * p) / q;
+        return true;
+    }
+
+private:
+    BigInt p, d, q;
+    BigInt sqrtD;
+    std::unique_ptr<RationalExpansion> rational;
+};
+
+// e = [2; 1, 2, 1, 1, 4, 1, 1, 6, 1, ...]
+class EExpansion : public ContinuedFractionExpansion
+{
+public:
+    bool NextTerm(BigInt& term) override
+    {
+        int index = termIndex++;
+        if (index == 0)
+            term = BigInt(2);
+        else if (index % 3 == 2)
+            term = BigInt(2 * ((index + 1) / 3));
+        else
+            term = BigInt(1);
+        return true;
+    }
+
+private:
+    int termIndex = 0;
+};
+
+// Expands a number that can be computed to any precision. The expansions of a lower and upper bound are
+// made in lockstep, and a term is only given out once both bounds agree on it. When they disagree the
+// bounds are recomputed with twice the precision.
+// The expansion of the bounds uses Lehmer's trick: most terms are found from the top 64 bits of the numbers,
+// and the big numbers are only touched once per batch of terms.
+class BoundedExpansion : public ContinuedFractionExpansion
+{
+public:
+    bool NextTerm(BigInt& term) override
+    {
+        while (pendingTermIndex == pendingTerms.size())
+        {
+            static const size_t c_termsPerBatch = 32;
+            pendingTerms.clear();
+            pendingTermIndex = 0;
+            if (precisionBits == 0 || AdvanceBounds(c_termsPerBatch, &pendingTerms) == 0)
+                Refine();
+        }
+
+        term = pendingTerms[pendingTermIndex++];
+        return true;
+    }
+
+protected:
+    // Gets integers lower and upper such that lower / 2^bits <= x <= upper / 2^bits
+    virtual void GetBounds(size_t bits, BigInt& lower, BigInt& upper) = 0;
+
+private:
+    struct Fraction
+    {
+        BigInt numerator;
+        BigInt denominator;
+    };
+
+    // Steps both bounds past up to maxTerms terms that they agree on, and returns how many that was.
+    // The terms are added to terms, if it isn't null.
+    size_t AdvanceBounds(size_t maxTerms, std::vector<BigInt>* terms)
+    {
+        size_t count = 0;
+        while (count < maxTerms)
+        {
+            size_t batchCount = AdvanceBoundsFromTopBits(maxTerms - count, terms);
+            if (batchCount == 0)
+            {
+                BigInt term;
+                if (!AdvanceBoundsExact(term))
+                    break;
+                if (terms)
+                    terms->push_back(term);
+                batchCount = 1;
+            }
+            count += batchCount;
+        }
+        termCount += count;
+        return count;
+    }
+
+    // one step of the Euclidean algorithm on both bounds
+    bool AdvanceBoundsExact(BigInt& term)
+    {
+        // a zero denominator means a bound landed exactly on a rational number, so it can't tell us more
+        if (lower.denominator.IsZero() || upper.denominator.IsZero())
+            return false;
+
+        BigInt lowerRemainder, upperRemainder, upperTerm;
+        BigInt::FloorDivMod(lower.numerator, lower.denominator, term, lowerRemainder);
+        BigInt::FloorDivMod(upper.numerator, upper.denominator, upperTerm, upperRemainder);
+        if (term != upperTerm)
+            return false;
+
+        lower.numerator.swap(lower.denominator);
+        lower.denominator.swap(lowerRemainder);
+        upper.numerator.swap(upper.denominator);
+        upper.denominator.swap(upperRemainder);
+        return true;
+    }
+
+    // Finds terms using only the top bits of the bounds, then applies them all to the bounds at once.
+    size_t AdvanceBoundsFromTopBits(size_t maxTerms, std::vector<BigInt>* terms)
+    {
+        // top bits give a range that each bound lies in. Any term shared by both ends of both ranges is a
+        // term of both bounds.
+        uint64_t numerators[4], denominators[4];
+        if (!GetTopBitsRange(lower, numerators[0], denominators[0], numerators[1], denominators[1]) ||
+            !GetTopBitsRange(upper, numerators[2], denominators[2], numerators[3], denominators[3]))
+            return 0;
+
+        // (numerator', denominator') = matrix * (numerator, denominator) after stepping past the terms.
+        // Entries are kept under 2^31 so they can be applied with small multiplies.
+        static const int64_t c_maxEntry = int64_t(1) << 31;
+        int64_t matrix[2][2] = { { 1, 0 }, { 0, 1 } };
+        size_t count = 0;
+        while (count < maxTerms)
+        {
+            if (denominators[0] == 0)
+                break;
+            uint64_t term = numerators[0] / denominators[0];
+            if (term >= uint64_t(c_maxEntry))
+                break;
+
+            bool agree = true;
+            for (int index = 1; index < 4 && agree; ++index)
+                agree = denominators[index] != 0 && numerators[index] / denominators[index] == term;
+            if (!agree)
+                break;
+
+            int64_t nextRow[2] = { matrix[0][0] - int64_t(term) * matrix[1][0], matrix[0][1] - int64_t(term) * matrix[1][1] };
+            if (std::abs(nextRow[0]) >= c_maxEntry || std::abs(nextRow[1]) >= c_maxEntry)
+                break;
+
+            matrix[0][0] = matrix[1][0];
+            matrix[0][1] = matrix[1][1];
+            matrix[1][0] = nextRow[0];
+            matrix[1][1] = nextRow[1];
+            for (int index = 0; index < 4; ++index)
+            {
+                uint64_t remainder = numerators[index] - term * denominators[index];
+                numerators[index] = denominators[index];
+                denominators[index] = remainder;
+            }
+
+            if (terms)
+                terms->push_back(BigInt::FromUInt64(term));
+            count++;
+        }
+
+        if (count > 0)
+        {
+            ApplyMatrix(matrix, lower);
+            ApplyMatrix(matrix, upper);
+        }
+        return count;
+    }
+
+    // Gets a range [lowNumerator / lowDenominator, highNumerator / highDenominator] containing the fraction,
+    // from its top 62 bits. Only works once the fraction is positive and more than 1, which it is after the
+    // first term.
+    static bool GetTopBitsRange(const Fraction& fraction, uint64_t& lowNumerator, uint64_t& lowDenominator, uint64_t& highNumerator, uint64_t& highDenominator)
+    {
+        if (fraction.numerator.Sign() <= 0 || fraction.denominator.Sign() <= 0 || fraction.numerator < fraction.denominator)
+            return false;
+
+        size_t bits = fraction.numerator.BitLength();
+        size_t shift = bits > 62 ? bits - 62 : 0;
+        uint64_t numeratorTop = 0, denominatorTop = 0;
+        (fraction.numerator >> shift).ToUInt64(numeratorTop);
+        (fraction.denominator >> shift).ToUInt64(denominatorTop);
+        if (denominatorTop == 0)
+            return false;
+
+        // exact when nothing was shifted off
+        lowNumerator = numeratorTop;
+        lowDenominator = shift ? denominatorTop + 1 : denominatorTop;
+        highNumerator = shift ? numeratorTop + 1 : numeratorTop;
+        highDenominator = denominatorTop;
+        return true;
+    }
+
+    static void ApplyMatrix(const int64_t matrix[2][2], Fraction& fraction)
+    {
+        BigInt numerator = BigInt::MulSmall(fraction.numerator, matrix[0][0]) + BigInt::MulSmall(fraction.denominator, matrix[0][1]);
+        BigInt denominator = BigInt::MulSmall(fraction.numerator, matrix[1][0]) + BigInt::MulSmall(fraction.denominator, matrix[1][1]);
+        fraction.numerator.swap(numerator);
+        fraction.denominator.swap(denominator);
+    }
+
+    void Refine()
+    {
+        precisionBits = precisionBits == 0 ? 64 : precisionBits * 2;
+
+        GetBounds(precisionBits, lower.numerator, upper.numerator);
+        lower.denominator = BigInt(1) << precisionBits;
+        upper.denominator = lower.denominator;
+
+        // the tighter bounds agree on every term found so far, so just step past them
+        size_t replayCount = termCount;
+        termCount = 0;
+        AdvanceBounds(replayCount, nullptr);
+    }
+
+    size_t precisionBits = 0;
+    size_t termCount = 0;
+    Fraction lower;
+    Fraction upper;
+
+    std::vector<BigInt> pendingTerms;
+    size_t pendingTermIndex = 0;
+};
+
+// pi, computed with Machin's formula: pi = 16 * atan(1/5) - 4 * atan(1/239)
+class PiExpansion : public BoundedExpansion
+{
+protected:
+    void GetBounds(size_t bits, BigInt& lower, BigInt& upper) override
+    {
+        static const size_t c_guardBits = 32;
+        size_t workingBits = bits + c_guardBits;
+
+        size_t seriesTermCount = 0;
+        BigInt pi = ArctanInverse(5, workingBits, seriesTermCount) * BigInt(16) - ArctanInverse(239, workingBits, seriesTermCount) * BigInt(4);
+
+        // every series term is truncated, which is off by less than 2 units each, and the largest arctan is scaled by 16
+        BigInt error = BigInt(int64_t(seriesTermCount + 2) * 32);
+        lower = (pi - error) >> c_guardBits;
+        upper = ((pi + error) >> c_guardBits) + BigInt(1);
+    }
+
+private:
+    // atan(1/x) * 2^bits = sum over k of (-1)^k / ((2k+1) * x^(2k+1))
+    static BigInt ArctanInverse(uint32_t x, size_t bits, size_t& seriesTermCount)
+    {
+        uint32_t xSquared = x * x;
+        BigInt power = BigInt(1) << bits;
+        power.DivModSmall(x);
+        BigInt sum = power;
+        BigInt term;
+        for (uint32_t k = 1; !power.IsZero(); ++k)
+        {
+            power.DivModSmall(xSquared);
+            term = power;
+            term.DivModSmall(2 * k + 1);
+            if (k & 1)
+                sum -= term;
+            else
+                sum += term;
+            seriesTermCount++;
+        }
+        return sum;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Periodic continued fractions of quadratic surds, using only 64 bit integer math.
+
+// a continued fraction written as [prePeriod; period, period, period, ...]
+struct PeriodicContinuedFraction
+{
+    std::vector<int64_t> prePeriod;
+    std::vector<int64_t> period; // empty for rational numbers
+};
+
+// floor(sqrt(n)) using Newton's method on integers
+inline uint64_t ISqrt(uint64_t n)
+{
+    if (n < 2)
+        return n;
+
+    // start from a power of two at or above the answer, then Newton's method decreases monotonically to it
+    int bits = 0;
+    for (uint64_t value = n; value != 0; value >>= 1)
+        bits++;
+    uint64_t x = uint64_t(1) << ((bits + 1) / 2);
+    while (true)
+    {
+        uint64_t y = (x + n / x) >> 1;
+        if (y >= x)
+            return x;
+        x = y;
+    }
+}
+
+// result = a * b, returning false if it overflows
+inline bool CheckedMul(int64_t a, int64_t b, int64_t& result)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return !__builtin_mul_overflow(a, b, &result);
+#else
+    uint64_t absA = a < 0 ? ~uint64_t(a) + 1 : uint64_t(a);
+    uint64_t absB = b < 0 ? ~uint64_t(b) + 1 : uint64_t(b);
+    bool negative = (a < 0) != (b < 0);
+    uint64_t limit = negative ? uint64_t(INT64_MAX) + 1 : uint64_t(INT64_MAX);
+    if (absA != 0 && absB > limit / absA)
+        return false;
+    uint64_t magnitude = absA * absB;
+    result = negative ? int64_t(~magnitude + 1) : int64_t(magnitude);
+    return true;
+#endif
+}
+
+inline int64_t FloorDiv(int64_t a, int64_t b)
+{
+    int64_t quotient = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0)))
+        quotient--;
+    return quotient;
+}
+
+// Expands sqrt(n) = [a0; period] for n < 2^62. The period always ends with 2 * a0.
+// result is passed in so its memory can be reused when expanding many numbers.
+// The period before 2 * a0 is a palindrome, so only the first half of it is computed. The middle is where the
+// m or d sequences repeat a value.
+inline void SqrtContinuedFraction(uint64_t n, PeriodicContinuedFraction& result)
+{
+    result.prePeriod.clear();
+    result.period.clear();
+
+    int64_t a0 = int64_t(ISqrt(n));
+    result.prePeriod.push_back(a0);
+    if (uint64_t(a0) * uint64_t(a0) == n)
+        return;
+
+    // sqrt(n) = a0 + 1 / x, and each x is (sqrt(n) + m) / d.
+    // d is updated with d[k+1] = d[k-1] + a[k] * (m[k] - m[k+1]) to avoid dividing.
+    int64_t m = 0, d = 1, a = a0;
+    int64_t lastD = int64_t(n);
+    std::vector<int64_t>& period = result.period;
+    while (true)
+    {
+        int64_t nextM = d * a - m;
+        if (nextM == m && !period.empty())
+        {
+            // even length period, the terms so far are the first half including the middle term
+            for (size_t index = period.size() - 1; index-- > 0; )
+                period.push_back(period[index]);
+            break;
+        }
+
+        int64_t nextD = lastD + a * (m - nextM);
+        lastD = d;
+        m = nextM;
+        d = nextD;
+        a = (a0 + m) / d;
+        if (a == 2 * a0)
+            break;
+        period.push_back(a);
+
+        if (d == lastD)
+        {
+            // odd length period, the last two terms are the middle pair
+            for (size_t index = period.size() - 2; index-- > 0; )
+                period.push_back(period[index]);
+            break;
+        }
+    }
+    period.push_back(2 * a0);
+}
+
+// The first termCount terms of sqrt(n) for n < 2^62, using the same recurrence as SqrtContinuedFraction but
+// without finding the period, which can be far longer than the terms needed.
+inline void SqrtContinuedFractionTerms(uint64_t n, int termCount, std::vector<int64_t>& terms)
+{
+    terms.clear();
+    if (termCount <= 0)
+        return;
+
+    int64_t a0 = int64_t(ISqrt(n));
+    terms.push_back(a0);
+    if (uint64_t(a0) * uint64_t(a0) == n)
+        return;
+
+    int64_t m = 0, d = 1, a = a0;
+    int64_t lastD = int64_t(n);
+    while (int(terms.size()) < termCount)
+    {
+        int64_t nextM = d * a - m;
+        int64_t nextD = lastD + a * (m - nextM);
+        lastD = d;
+        m = nextM;
+        d = nextD;
+        a = (a0 + m) / d;
+        terms.push_back(a);
+    }
+}
+
+// The first termCount terms of a periodic continued fraction, or all of them if it is rational and has fewer.
+inline void PeriodicContinuedFractionTerms(const PeriodicContinuedFraction& continuedFraction, int termCount, std::vector<int64_t>& terms)
+{
+    terms.clear();
+    for (size_t index = 0; index < continuedFraction.prePeriod.size() && int(terms.size()) < termCount; ++index)
+        terms.push_back(continuedFraction.prePeriod[index]);
+
+    const std::vector<int64_t>& period = continuedFraction.period;
+    for (size_t index = 0; !period.empty() && int(terms.size()) < termCount; index = (index + 1) % period.size())
+        terms.push_back(period[index]);
+}
+
+// Expands (a + sqrt(n)) / b. Returns false if the numbers involved overflow 64 bits, which can only happen when
+// a, b or n are very large.
+// A quadratic surd's continued fraction becomes purely periodic once it is reduced (x > 1 and its conjugate is
+// between -1 and 0), and after that the (p, q) state repeats at the end of every period.
+inline bool QuadraticSurdContinuedFraction(int64_t a, uint64_t n, int64_t b, PeriodicContinuedFraction& result)
+{
+    result.prePeriod.clear();
+    result.period.clear();
+
+    if (b == 0 || n > uint64_t(INT64_MAX))
+        return false;
+
+    // x = (p + sqrt(d)) / q, where q must divide d - p^2 for the recurrence to stay in integers
+    int64_t p = a, q = b, d = int64_t(n);
+    int64_t pSquared;
+    if (!CheckedMul(p, p, pSquared))
+        return false;
+    if ((d - pSquared) % q != 0)
+    {
+        int64_t absQ = q < 0 ? -q : q;
+        int64_t qSquared;
+        if (!CheckedMul(p, absQ, p) || !CheckedMul(q, q, qSquared) || !CheckedMul(d, qSquared, d) || !CheckedMul(q, absQ, q))
+            return false;
+    }
+
+    int64_t s = int64_t(ISqrt(uint64_t(d)));
+    if (s * s == d)
+    {
+        // rational, so the Euclidean algorithm finishes it
+        int64_t numerator = p + s, denominator = q;
+        while (denominator != 0)
+        {
+            int64_t term = FloorDiv(numerator, denominator);
+            result.prePeriod.push_back(term);
+            int64_t remainder = numerator - term * denominator;
+            numerator = denominator;
+            denominator = remainder;
+        }
+        return true;
+    }
+
+    int64_t periodStartP = 0, periodStartQ = 0;
+    bool inPeriod = false;
+    while (true)
+    {
+        if (!inPeriod && p > 0 && p <= s && q > s - p && q <= s + p)
+        {
+            inPeriod = true;
+            periodStartP = p;
+            periodStartQ = q;
+        }
+
+        // floor((p + sqrt(d)) / q). sqrt(d) is irrational, so which integer to round it to depends on the sign of q.
+        int64_t term = q < 0 ? FloorDiv(p + s + 1, q) : FloorDiv(p + s, q);
+        (inPeriod ? result.period : result.prePeriod).push_back(term);
+
+        // 1 / (x - term) = (p' + sqrt(d)) / q'. the division is exact.
+        int64_t termQ;
+        if (!CheckedMul(term, q, termQ) || !CheckedMul(termQ - p, termQ - p, pSquared))
+            return false;
+        p = termQ - p;
+        q = (d - pSquared) / q;
+
+        if (inPeriod && p == periodStartP && q == periodStartQ)
+            return true;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Convergents p[n] / q[n], made front to back with p[n] = a[n] * p[n-1] + p[n-2] (and the same for q), so every
+// convergent of a k term continued fraction takes O(k) total.
+
+// result = a * b + c for the types convergents can be stored in. Returns false on overflow.
+inline bool MulAddChecked(uint64_t a, uint64_t b, uint64_t c, uint64_t& result)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    uint64_t product;
+    return !__builtin_mul_overflow(a, b, &product) && !__builtin_add_overflow(product, c, &result);
+#else
+    if (a != 0 && b > UINT64_MAX / a)
+        return false;
+    uint64_t product = a * b;
+    result = product + c;
+    return result >= product;
+#endif
+}
+
+// unsigned __int128 is only available on gcc and clang
+#if defined(__SIZEOF_INT128__)
+inline bool MulAddChecked(unsigned __int128 a, unsigned __int128 b, unsigned __int128 c, unsigned __int128& result)
+{
+    unsigned __int128 product;
+    return !__builtin_mul_overflow(a, b, &product) && !__builtin_add_overflow(product, c, &result);
+}
+#endif
+
+inline bool MulAddChecked(const BigInt& a, const BigInt& b, const BigInt& c, BigInt& result)
+{
+    result = a * b + c;
+    return true;
+}
+
+// T is uint64_t, unsigned __int128 (where available) or BigInt. The unsigned types need non-negative terms.
+template <typename T>
+class ConvergentIterator
+{
+public:
+    // Adds the next term and makes the next convergent. Returns false if the convergent overflowed T, in which
+    // case the iterator stays on the last convergent that fit, and won't take more terms.
+    bool AddTerm(const T& term)
+    {
+        if (overflowed)
+            return false;
+
+        T nextNumerator, nextDenominator;
+        if (!MulAddChecked(term, numerator, lastNumerator, nextNumerator) ||
+            !MulAddChecked(term, denominator, lastDenominator, nextDenominator))
+        {
+            overflowed = true;
+            return false;
+        }
+
+        lastNumerator = numerator;
+        lastDenominator = denominator;
+        numerator = nextNumerator;
+        denominator = nextDenominator;
+        count++;
+        return true;
+    }
+
+    // the convergent made from the first Count() terms
+    const T& Numerator() const { return numerator; }
+    const T& Denominator() const { return denominator; }
+    int Count() const { return count; }
+    bool Overflowed() const { return overflowed; }
+
+private:
+    // before any terms, the recurrence starts from p[-1] / q[-1] = 1/0 and p[-2] / q[-2] = 0/1
+    T numerator = T(1);
+    T denominator = T(0);
+    T lastNumerator = T(0);
+    T lastDenominator = T(1);
+    int count = 0;
+    bool overflowed = false;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <charconv>
+
+// Writes rows of labeled numbers to a file, through a large buffer that is flushed in big chunks.
+//
+// CSV format writes a row as "label","value","value",... with each value in the shortest form that reads back
+// to the exact same double.
+//
+// Binary format starts the file with the 4 characters CFR1, then writes each row as a uint32 label length, the
+// label characters, a uint32 value count and the values as doubles. The integers and doubles are in the byte
+// order of the machine that wrote them.
+class ResultWriter
+{
+public:
+    enum class Format
+    {
+        CSV,
+        Binary
+    };
+
+    ResultWriter(const char* fileName, Format format = Format::CSV, size_t bufferSize = 1 << 20)
+        : format(format)
+    {
+        // every value has to fit in the buffer on its own
+        buffer.resize(std::max(bufferSize, c_maxValueSize));
+
+        fopen_s(&file, fileName, "wb");
+        if (file && format == Format::Binary)
+            Append("CFR1", 4);
+    }
+
+    ~ResultWriter()
+    {
+        Close();
+    }
+
+    ResultWriter(const ResultWriter&) = delete;
+    ResultWriter& operator=(const ResultWriter&) = delete;
+
+    bool IsOpen() const
+    {
+        return file != nullptr;
+    }
+
+    void WriteRow(const char* label, const double* values, size_t valueCount)
+    {
+        if (!file)
+            return;
+
+        size_t labelLength = strlen(label);
+        if (format == Format::Binary)
+        {
+            uint32_t length32 = uint32_t(labelLength);
+            uint32_t valueCount32 = uint32_t(valueCount);
+            Append(&length32, sizeof(length32));
+            Append(label, labelLength);
+            Append(&valueCount32, sizeof(valueCount32));
+            Append(values, valueCount * sizeof(double));
+            return;
+        }
+
+        Append("\"", 1);
+        Append(label, labelLength);
+        Append("\"", 1);
+        for (size_t index = 0; index < valueCount; ++index)
+        {
+            if (buffer.size() - used < c_maxValueSize)
+                Flush();
+
+            char* out = &buffer[used];
+            *out++ = ',';
+            *out++ = '"';
+            out = std::to_chars(out, &buffer[0] + buffer.size(), values[index]).ptr;
+            *out++ = '"';
+            used = out - &buffer[0];
+        }
+        Append("\n", 1);
+    }
+
+    void WriteRow(const char* label, const std::vector<double>& values)
+    {
+        WriteRow(label, values.data(), values.size());
+    }
+
+    void Close()
+    {
+        if (!file)
+            return;
+        Flush();
+        fclose(file);
+        file = nullptr;
+    }
+
+private:
+    // a separator, two quotes, and the longest shortest round trip double, like -2.2250738585072014e-308
+    static constexpr size_t c_maxValueSize = 32;
+
+    void Append(const void* data, size_t size)
+    {
+        // data that wouldn't fit even in an empty buffer goes straight to the file
+        if (used + size > buffer.size())
+        {
+            Flush();
+            if (size > buffer.size())
+            {
+                fwrite(data, 1, size, file);
+                return;
+            }
+        }
+
+        memcpy(&buffer[used], data, size);
+        used += size;
+    }
+
+    void Flush()
+    {
+        if (used > 0)
+            fwrite(&buffer[0], 1, used, file);
+        used = 0;
+    }
+
+    FILE* file = nullptr;
+    Format format;
+    std::vector<char> buffer;
+    size_t used = 0;
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <stdint.h>
+
+// A fixed set of worker threads that can run a loop body across all cores.
+// The thread calling ParallelFor does work too, so a pool of N threads has N-1 workers.
+class ThreadPool
+{
+public:
+    // threadCount of 0 means one thread per hardware thread
+    explicit ThreadPool(int threadCount = 0)
+    {
+        if (threadCount <= 0)
+            threadCount = std::max((int)std::thread::hardware_concurrency(), 1);
+
+        for (int threadIndex = 1; threadIndex < threadCount; ++threadIndex)
+            threads.emplace_back([this]() { WorkerThread(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        workAvailable.notify_all();
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int ThreadCount() const
+    {
+        return (int)threads.size() + 1;
+    }
+
+    // Calls func(index) for every index in [0, count) and returns once they have all finished.
+    // Calls made from inside a loop body run serially on the calling thread.
+    template <typename LAMBDA>
+    void ParallelFor(int count, const LAMBDA& func)
+    {
+        if (threads.empty() || count <= 1 || InsideJob())
+        {
+            for (int index = 0; index < count; ++index)
+                func(index);
+            return;
+        }
+
+        // the job captures the loop through a single reference, small enough for std::function to store without
+        // allocating
+        struct Loop
+        {
+            std::atomic<int> nextIndex;
+            int count;
+            const LAMBDA& func;
+        };
+        Loop loop{ {0}, count, func };
+        RunOnAllThreads(
+            [&loop]()
+            {
+                int index;
+                while ((index = loop.nextIndex.fetch_add(1)) < loop.count)
+                    loop.func(index);
+            }
+        );
+    }
+
+    // Same as ParallelFor, but each thread starts on its own contiguous share of the indices, and steals the back
+    // half of the largest remaining share once its own runs out. Neighboring indices mostly run on the same thread,
+    // and loop bodies of very uneven cost still balance out across the threads.
+    template <typename LAMBDA>
+    void ParallelForStealing(int count, const LAMBDA& func)
+    {
+        if (threads.empty() || count <= 1 || InsideJob())
+        {
+            for (int index = 0; index < count; ++index)
+                func(index);
+            return;
+        }
+
+        // each share is a [begin, end) range packed into one atomic so it can be split with a single compare exchange
+        int threadCount = ThreadCount();
+        std::vector<std::atomic<uint64_t>> ranges(threadCount);
+        for (int threadIndex = 0; threadIndex < threadCount; ++threadIndex)
+        {
+            int begin = int(int64_t(count) * threadIndex / threadCount);
+            int end = int(int64_t(count) * (threadIndex + 1) / threadCount);
+            ranges[threadIndex] = PackRange(begin, end);
+        }
+
+        std::atomic<int> nextRange(0);
+        RunOnAllThreads(
+            [&]()
+            {
+                std::atomic<uint64_t>& range = ranges[nextRange.fetch_add(1)];
+                do
+                {
+                    int index;
+                    while (TakeFromRange(range, index))
+                        func(index);
+                }
+                while (StealRange(ranges, range));
+            }
+        );
+    }
+
+private:
+    static uint64_t PackRange(int begin, int end)
+    {
+        return uint64_t(uint32_t(begin)) | (uint64_t(uint32_t(end)) << 32);
+    }
+
+    static void UnpackRange(uint64_t range, int& begin, int& end)
+    {
+        begin = int(uint32_t(range));
+        end = int(uint32_t(range >> 32));
+    }
+
+    // takes the first index of the range, if there is one
+    static bool TakeFromRange(std::atomic<uint64_t>& range, int& index)
+    {
+        uint64_t value = range.load();
+        while (true)
+        {
+            int begin, end;
+            UnpackRange(value, begin, end);
+            if (begin >= end)
+                return false;
+            if (range.compare_exchange_weak(value, PackRange(begin + 1, end)))
+            {
+                index = begin;
+                return true;
+            }
+        }
+    }
+
+    // moves the back half of the largest range into the empty range ownRange. Returns false if there is no work left.
+    static bool StealRange(std::vector<std::atomic<uint64_t>>& ranges, std::atomic<uint64_t>& ownRange)
+    {
+        while (true)
+        {
+            std::atomic<uint64_t>* victim = nullptr;
+            uint64_t victimValue = 0;
+            int victimSize = 0;
+            for (std::atomic<uint64_t>& range : ranges)
+            {
+                uint64_t value = range.load();
+                int begin, end;
+                UnpackRange(value, begin, end);
+                if (end - begin > victimSize)
+                {
+                    victim = &range;
+                    victimValue = value;
+                    victimSize = end - begin;
+                }
+            }
+
+            if (!victim)
+                return false;
+
+            // a range only ever holds indices nobody has run yet, so seeing the same value means nothing changed
+            int begin, end;
+            UnpackRange(victimValue, begin, end);
+            int middle = begin + (end - begin) / 2;
+            if (victim->compare_exchange_strong(victimValue, PackRange(begin, middle)))
+            {
+                ownRange = PackRange(middle, end);
+                return true;
+            }
+        }
+    }
+
+    // true on threads that are currently running a loop body
+    static bool& InsideJob()
+    {
+        static thread_local bool insideJob = false;
+        return insideJob;
+    }
+
+    // runs job once on every thread in the pool, including the calling thread
+    void RunOnAllThreads(const std::function<void()>& job)
+    {
+        // only one ParallelFor can own the workers at a time
+        std::lock_guard<std::mutex> ownerLock(ownerMutex);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentJob = &job;
+            jobsRunning = (int)threads.size();
+            jobGeneration++;
+        }
+        workAvailable.notify_all();
+
+        InsideJob() = true;
+        job();
+        InsideJob() = false;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        workFinished.wait(lock, [this]() { return jobsRunning == 0; });
+        currentJob = nullptr;
+    }
+
+    void WorkerThread()
+    {
+        InsideJob() = true;
+        unsigned int lastJobGeneration = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            workAvailable.wait(lock, [&]() { return quit || jobGeneration != lastJobGeneration; });
+            if (quit)
+                return;
+            lastJobGeneration = jobGeneration;
+
+            const std::function<void()>* job = currentJob;
+            lock.unlock();
+            (*job)();
+            lock.lock();
+
+            if (--jobsRunning == 0)
+                workFinished.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads;
+
+    std::mutex ownerMutex;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable workFinished;
+    const std::function<void()>* currentJob = nullptr;
+    unsigned int jobGeneration = 0;
+    int jobsRunning = 0;
+    bool quit = false;
+};
@@ -1,11 +1,43 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <stdio.h>
+#include <assert.h>
 #include <vector>
 #include <algorithm>
 #include <cmath>
 #include <random>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+#include <string>
 
+#include "CPUFeatures.h"
+#include "ThreadPool.h"
+#include "BufferPool.h"
+#include "ContinuedFractionExpansion.h"
+#include "ResultWriter.h"
+
+// stb_image_write encodes animation frames and bands of PNG rows through this, using the pool main sets up
+static ThreadPool* g_pngThreadPool = nullptr;
+
+static void PNGParallelFor(int count, void (*func)(void*, int), void* context)
+{
+    if (!g_pngThreadPool)
+    {
+        for (int index = 0; index < count; ++index)
+            func(context, index);
+        return;
+    }
+    g_pngThreadPool->ParallelFor(count, [&](int index) { func(context, index); });
+}
+
+// everything stb_image_write allocates comes from this, so encoding frame after frame reuses the same memory
+static BufferPool g_pngBufferPool;
+
+#define STBIW_PARALLEL_FOR(count, func, context) PNGParallelFor(count, func, context)
+#define STBIW_MALLOC(size) g_pngBufferPool.Allocate(size)
+#define STBIW_REALLOC(block, size) g_pngBufferPool.Reallocate(block, size)
+#define STBIW_FREE(block) g_pngBufferPool.Free(block)
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
@@ -30,6 +62,10 @@ std::vector<int> ToContinuedFraction(double f, int maxContinuedFractionTerms = 2
 
     while (maxContinuedFractionTerms == 0 || int(continuedFraction.size()) < maxContinuedFractionTerms)
     {
+        // a term too large for an int means the previous fractional part was really zero, so we are done
+        if (f >= double(INT_MAX))
+            break;
+
         // break the number into the integer and fractional part.
         int integerPart = int(f);
         double fractionalPart = f - floor(f);
@@ -63,22 +99,202 @@ double FromContinuedFraction(const std::vector<int>& continuedFraction, int coun
     return ret;
 }
 
-void ToFraction(const std::vector<int>& continuedFraction, int count, size_t& numerator, size_t& denominator)
+// The values of every truncation of many continued fractions. Value k of continued fraction i uses its first k+1
+// terms and is stored at values[offsets[i] + k].
+struct ContinuedFractionTruncations
 {
-    numerator = 0;
-    denominator = 1;
+    std::vector<size_t> offsets;
+    std::vector<double> values;
+};
 
-    if (count == 0)
-        count = (int)continuedFraction.size();
-    int index = std::min(count, (int)continuedFraction.size()) - 1;
+// numerators and denominators get rescaled by an exact power of two once they pass this, so they never overflow
+// and the ratios come out the same as they would without the rescaling.
+static const double c_truncationRescaleLimit = std::ldexp(1.0, 512);
+static const double c_truncationRescale = std::ldexp(1.0, -512);
 
-    for (; index >= 0; --index)
+void ContinuedFractionTruncationsScalar(const std::vector<int>& continuedFraction, double* values)
+{
+    // forward recurrence: h[n] = a[n]*h[n-1] + h[n-2], k[n] = a[n]*k[n-1] + k[n-2]
+    double h = 1.0, lastH = 0.0;
+    double k = 0.0, lastK = 1.0;
+    for (size_t index = 0; index < continuedFraction.size(); ++index)
+    {
+        double term = double(continuedFraction[index]);
+        double nextH = term * h + lastH;
+        double nextK = term * k + lastK;
+        lastH = h;
+        lastK = k;
+        h = nextH;
+        k = nextK;
+
+        if (std::abs(h) > c_truncationRescaleLimit || k > c_truncationRescaleLimit)
+        {
+            h *= c_truncationRescale;
+            k *= c_truncationRescale;
+            lastH *= c_truncationRescale;
+            lastK *= c_truncationRescale;
+        }
+
+        values[index] = h / k;
+    }
+}
+
+#if CPU_X86
+// the same recurrence as ContinuedFractionTruncationsScalar, run on 4 continued fractions at once, one per lane.
+TARGET_AVX2 void ContinuedFractionTruncationsAVX2(const std::vector<int>* const continuedFractions[4], double* const values[4])
+{
+    size_t sizes[4];
+    const int* terms[4];
+    size_t minSize = SIZE_MAX, maxSize = 0;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        sizes[lane] = continuedFractions[lane] ? continuedFractions[lane]->size() : 0;
+        terms[lane] = sizes[lane] ? continuedFractions[lane]->data() : nullptr;
+        minSize = std::min(minSize, sizes[lane]);
+        maxSize = std::max(maxSize, sizes[lane]);
+    }
+
+    const __m256d rescaleLimit = _mm256_set1_pd(c_truncationRescaleLimit);
+    const __m256d rescale = _mm256_set1_pd(c_truncationRescale);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d absMask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffll));
+
+    __m256d h = one, lastH = _mm256_setzero_pd();
+    __m256d k = _mm256_setzero_pd(), lastK = one;
+    alignas(32) double results[4];
+    for (size_t index = 0; index < maxSize; ++index)
+    {
+        // lanes that have run out of terms keep going on zeros, their results are never stored
+        __m128i laneTerms;
+        if (index < minSize)
+            laneTerms = _mm_set_epi32(terms[3][index], terms[2][index], terms[1][index], terms[0][index]);
+        else
+        {
+            laneTerms = _mm_set_epi32(
+                index < sizes[3] ? terms[3][index] : 0,
+                index < sizes[2] ? terms[2][index] : 0,
+                index < sizes[1] ? terms[1][index] : 0,
+                index < sizes[0] ? terms[0][index] : 0
+            );
+        }
+        __m256d term = _mm256_cvtepi32_pd(laneTerms);
+
+        __m256d nextH = _mm256_add_pd(_mm256_mul_pd(term, h), lastH);
+        __m256d nextK = _mm256_add_pd(_mm256_mul_pd(term, k), lastK);
+        lastH = h;
+        lastK = k;
+        h = nextH;
+        k = nextK;
+
+        __m256d tooLarge = _mm256_or_pd(
+            _mm256_cmp_pd(_mm256_and_pd(h, absMask), rescaleLimit, _CMP_GT_OQ),
+            _mm256_cmp_pd(k, rescaleLimit, _CMP_GT_OQ)
+        );
+        if (!_mm256_testz_pd(tooLarge, tooLarge))
+        {
+            __m256d scale = _mm256_blendv_pd(one, rescale, tooLarge);
+            h = _mm256_mul_pd(h, scale);
+            k = _mm256_mul_pd(k, scale);
+            lastH = _mm256_mul_pd(lastH, scale);
+            lastK = _mm256_mul_pd(lastK, scale);
+        }
+
+        __m256d result = _mm256_div_pd(h, k);
+        if (index < minSize)
+        {
+            _mm_storel_pd(&values[0][index], _mm256_castpd256_pd128(result));
+            _mm_storeh_pd(&values[1][index], _mm256_castpd256_pd128(result));
+            _mm_storel_pd(&values[2][index], _mm256_extractf128_pd(result, 1));
+            _mm_storeh_pd(&values[3][index], _mm256_extractf128_pd(result, 1));
+        }
+        else
+        {
+            _mm256_store_pd(results, result);
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                if (index < sizes[lane])
+                    values[lane][index] = results[lane];
+            }
+        }
+    }
+}
+#endif
+
+// Evaluates all truncations of all the continued fractions. Same results as calling FromContinuedFraction for each
+// count, to within rounding, but runs in linear time per continued fraction instead of quadratic, and does 4
+// continued fractions at a time when the CPU has AVX2.
+void FromContinuedFractionTruncations(const std::vector<std::vector<int>>& continuedFractions, ContinuedFractionTruncations& truncations)
+{
+    truncations.offsets.resize(continuedFractions.size());
+    size_t totalSize = 0;
+    for (size_t index = 0; index < continuedFractions.size(); ++index)
+    {
+        truncations.offsets[index] = totalSize;
+        totalSize += continuedFractions[index].size();
+    }
+    truncations.values.resize(totalSize);
+
+    size_t index = 0;
+
+#if CPU_X86
+    static const bool useAVX2 = CPUSupportsAVX2();
+    if (useAVX2)
     {
-        if (numerator != 0)
-            std::swap(numerator, denominator);
-        numerator += size_t(continuedFraction[index]) * denominator;
+        for (; index < continuedFractions.size(); index += 4)
+        {
+            const std::vector<int>* lanes[4] = {};
+            double* laneValues[4] = {};
+            for (int lane = 0; lane < 4 && index + lane < continuedFractions.size(); ++lane)
+            {
+                lanes[lane] = &continuedFractions[index + lane];
+                laneValues[lane] = truncations.values.data() + truncations.offsets[index + lane];
+            }
+            ContinuedFractionTruncationsAVX2(lanes, laneValues);
+        }
+        return;
     }
+#endif
 
+    for (; index < continuedFractions.size(); ++index)
+        ContinuedFractionTruncationsScalar(continuedFractions[index], truncations.values.data() + truncations.offsets[index]);
+}
+
+// prints the convergents of the first termCount terms of an exact expansion, in one pass
+void PrintConvergents(ContinuedFractionExpansion&& expansion, const char* label, int termCount = 20)
+{
+    printf("\n\nShowing convergents of %s...\n", label);
+    ConvergentIterator<BigInt> convergents;
+    for (const BigInt& term : expansion.NextTerms(termCount))
+    {
+        if (!convergents.AddTerm(term))
+        {
+            printf("[%s] overflowed\n", term.ToString().c_str());
+            break;
+        }
+        printf("[%s] %s/%s\n", term.ToString().c_str(), convergents.Numerator().ToString().c_str(), convergents.Denominator().ToString().c_str());
+    }
+}
+
+// prints each truncation of the continued fraction of number, as a value, a fraction and a relative error. Stops
+// once the fraction doesn't fit in 64 bits.
+void PrintContinuedFractionEvaluation(double number, const char* label)
+{
+    printf("\n\nShowing evaluation of continued fraction of %s (%f)...\n", label, number);
+    std::vector<int> CF = ToContinuedFraction(number);
+
+    ConvergentIterator<uint64_t> convergents;
+    for (size_t i = 1; i < CF.size(); ++i)
+    {
+        if (!convergents.AddTerm(uint64_t(CF[i - 1])))
+        {
+            printf("[%i] overflowed 64 bits\n", CF[i - 1]);
+            break;
+        }
+        unsigned long long n = convergents.Numerator(), d = convergents.Denominator();
+        double value = FromContinuedFraction(CF, (int)i);
+        double relativeError = abs(value / number - 1.0);
+        printf("[%i] %f aka %llu/%llu (%f)\n", CF[i - 1], value, n, d, relativeError);
+    }
 }
 
 void PrintContinuedFraction(double f, const char* label = nullptr, int maxContinuedFractionTerms = 20)
@@ -93,27 +309,220 @@ void PrintContinuedFraction(double f, const char* label = nullptr, int maxContin
     printf("]\n");
 }
 
-void Test_ContinuedFractionError(const char* fileName, const std::vector<LabelAndNumber>& labelsAndNumbers)
+// prints the first termCount terms of an exact expansion
+void PrintContinuedFraction(ContinuedFractionExpansion&& expansion, const char* label, int termCount = 20)
+{
+    std::vector<BigInt> cf = expansion.NextTerms(termCount);
+    printf("%s = [%s", label, cf[0].ToString().c_str());
+    for (size_t index = 1; index < cf.size(); ++index)
+        printf(", %s", cf[index].ToString().c_str());
+    printf("]\n");
+}
+
+// prints a periodic continued fraction as [a0; a1, a2, (period)]
+void PrintContinuedFraction(const PeriodicContinuedFraction& cf, const char* label)
+{
+    printf("%s = [%lld", label, (long long)cf.prePeriod[0]);
+    for (size_t index = 1; index < cf.prePeriod.size(); ++index)
+        printf(index == 1 ? "; %lld" : ", %lld", (long long)cf.prePeriod[index]);
+    if (!cf.period.empty())
+    {
+        printf(cf.prePeriod.size() == 1 ? "; (" : ", (");
+        for (size_t index = 0; index < cf.period.size(); ++index)
+            printf(index == 0 ? "%lld" : ", %lld", (long long)cf.period[index]);
+        printf(")");
+    }
+    printf("]\n");
+}
+
+void Test_ContinuedFractionError(const char* fileName, const std::vector<LabelAndNumber>& labelsAndNumbers, ResultWriter::Format format = ResultWriter::Format::CSV)
+{
+    ResultWriter writer(fileName, format);
+    if (!writer.IsOpen())
+        return;
+
+    // evaluate every truncation of every number in one batch
+    std::vector<std::vector<int>> continuedFractions(labelsAndNumbers.size());
+    for (size_t index = 0; index < labelsAndNumbers.size(); ++index)
+        continuedFractions[index] = ToContinuedFraction(labelsAndNumbers[index].number);
+
+    ContinuedFractionTruncations truncations;
+    FromContinuedFractionTruncations(continuedFractions, truncations);
+
+    std::vector<double> errors;
+    for (size_t index = 0; index < labelsAndNumbers.size(); ++index)
+    {
+        const LabelAndNumber& labelAndNumber = labelsAndNumbers[index];
+
+        // the error of every truncation but the full continued fraction
+        const double* values = truncations.values.data() + truncations.offsets[index];
+        errors.clear();
+        for (int digits = 1; digits < continuedFractions[index].size(); ++digits)
+        {
+            double relativeError = values[digits - 1] / labelAndNumber.number - 1.0;
+            errors.push_back(abs(relativeError));
+        }
+        writer.WriteRow(labelAndNumber.label, errors);
+    }
+}
+
+// A numbered list of numbers for SweepContinuedFractionError. Items are made from their index when asked for, so a
+// catalogue can describe far more numbers than would fit in memory as a list.
+class SweepCatalogue
+{
+public:
+    virtual ~SweepCatalogue() {}
+
+    virtual size_t Count() const = 0;
+
+    // gives the label, value and first termCount continued fraction terms of an item. Terms must fit in an int.
+    virtual void GetItem(size_t index, int termCount, std::string& label, std::vector<int64_t>& terms, double& value) const = 0;
+};
+
+// sqrt(n) for every n in [first, last), with last <= 2^60
+class SqrtCatalogue : public SweepCatalogue
 {
-    FILE* file = nullptr;
-    fopen_s(&file, fileName, "w+t");
+public:
+    SqrtCatalogue(uint64_t first, uint64_t last)
+        : first(first)
+        , last(std::max(first, std::min(last, uint64_t(1) << 60)))
+    {
+    }
+
+    size_t Count() const override
+    {
+        return size_t(last - first);
+    }
+
+    void GetItem(size_t index, int termCount, std::string& label, std::vector<int64_t>& terms, double& value) const override
+    {
+        uint64_t n = first + index;
+
+        char buffer[32];
+        sprintf_s(buffer, "Sqrt(%llu)", (unsigned long long)n);
+        label = buffer;
+
+        SqrtContinuedFractionTerms(n, termCount, terms);
+        value = sqrt(double(n));
+    }
+
+private:
+    uint64_t first;
+    uint64_t last;
+};
+
+struct LabelAndPeriodicContinuedFraction
+{
+    const char* label;
+    PeriodicContinuedFraction continuedFraction;
+};
 
-    for (const LabelAndNumber& labelAndNumber : labelsAndNumbers)
+// numbers given by their periodic continued fractions
+class PeriodicCatalogue : public SweepCatalogue
+{
+public:
+    PeriodicCatalogue(const std::vector<LabelAndPeriodicContinuedFraction>& items)
+        : items(items)
     {
-        fprintf(file, "\"%s\"", labelAndNumber.label);
+    }
 
-        std::vector<int> continuedFraction = ToContinuedFraction(labelAndNumber.number);
+    size_t Count() const override
+    {
+        return items.size();
+    }
 
-        for (int digits = 1; digits < continuedFraction.size(); ++digits)
+    void GetItem(size_t index, int termCount, std::string& label, std::vector<int64_t>& terms, double& value) const override
+    {
+        const LabelAndPeriodicContinuedFraction& item = items[index];
+        label = item.label;
+
+        // terms after the first are at least 1, so after c_valueTermCount terms the denominators are at least
+        // fibonacci(c_valueTermCount), and the value is exact to double precision
+        static const int c_valueTermCount = 96;
+        PeriodicContinuedFractionTerms(item.continuedFraction, c_valueTermCount, terms);
+        value = 0.0;
+        for (size_t termIndex = terms.size(); termIndex-- > 0; )
         {
-            double value = FromContinuedFraction(continuedFraction, digits);
-            double relativeError = value / labelAndNumber.number - 1.0;
-            fprintf(file, ",\"%f\"", abs(relativeError));
+            if (termIndex + 1 < terms.size())
+                value = 1.0 / value;
+            value += double(terms[termIndex]);
         }
-        fprintf(file, "\n");
+
+        terms.resize(std::min(terms.size(), size_t(std::max(termCount, 0))));
     }
 
-    fclose(file);
+private:
+    std::vector<LabelAndPeriodicContinuedFraction> items;
+};
+
+// Writes the absolute relative error of the first termCount truncations of every number in the catalogue, one
+// row per number in catalogue order. Unlike Test_ContinuedFractionError, the last truncation is written too, since
+// the terms are only the start of the number's expansion and that truncation still has an error. It is 0 only for
+// numbers whose whole expansion fits in termCount terms, like the square root of a perfect square.
+// Numbers are done in blocks spread across the thread pool. A wave of blocks is finished and written out before
+// the next starts, which keeps the output in order and the memory use bounded however big the catalogue is.
+void SweepContinuedFractionError(const char* fileName, const SweepCatalogue& catalogue, int termCount, ThreadPool& threadPool, ResultWriter::Format format = ResultWriter::Format::CSV)
+{
+    static const size_t c_blockSize = 1024;
+    static const int c_blocksPerThread = 8;
+
+    ResultWriter writer(fileName, format);
+    if (!writer.IsOpen())
+        return;
+
+    struct Block
+    {
+        std::vector<std::string> labels;
+        std::vector<double> numbers;
+        std::vector<std::vector<int>> continuedFractions;
+        ContinuedFractionTruncations errors;
+        std::vector<int64_t> terms;
+    };
+
+    size_t count = catalogue.Count();
+    size_t blockCount = (count + c_blockSize - 1) / c_blockSize;
+    std::vector<Block> wave((size_t)threadPool.ThreadCount() * c_blocksPerThread);
+
+    for (size_t waveStart = 0; waveStart < blockCount; waveStart += wave.size())
+    {
+        int waveBlockCount = int(std::min(wave.size(), blockCount - waveStart));
+        threadPool.ParallelForStealing(waveBlockCount,
+            [&](int waveBlockIndex)
+            {
+                Block& block = wave[waveBlockIndex];
+                size_t first = (waveStart + waveBlockIndex) * c_blockSize;
+                size_t blockSize = std::min(c_blockSize, count - first);
+
+                block.labels.resize(blockSize);
+                block.numbers.resize(blockSize);
+                block.continuedFractions.resize(blockSize);
+                for (size_t index = 0; index < blockSize; ++index)
+                {
+                    catalogue.GetItem(first + index, termCount, block.labels[index], block.terms, block.numbers[index]);
+                    block.continuedFractions[index].assign(block.terms.begin(), block.terms.end());
+                }
+
+                // turn the truncations into errors in place
+                FromContinuedFractionTruncations(block.continuedFractions, block.errors);
+                for (size_t index = 0; index < blockSize; ++index)
+                {
+                    double* values = block.errors.values.data() + block.errors.offsets[index];
+                    for (size_t termIndex = 0; termIndex < block.continuedFractions[index].size(); ++termIndex)
+                        values[termIndex] = abs(values[termIndex] / block.numbers[index] - 1.0);
+                }
+            }
+        );
+
+        for (int waveBlockIndex = 0; waveBlockIndex < waveBlockCount; ++waveBlockIndex)
+        {
+            const Block& block = wave[waveBlockIndex];
+            for (size_t index = 0; index < block.labels.size(); ++index)
+            {
+                const double* values = block.errors.values.data() + block.errors.offsets[index];
+                writer.WriteRow(block.labels[index].c_str(), values, block.continuedFractions[index].size());
+            }
+        }
+    }
 }
 
 // -------------------------------------------------------------------------------
@@ -123,22 +532,730 @@ struct RGB
     unsigned char R, G, B;
 };
 
+// How the channels of an image are laid out in memory. Packed RGB is what image files take, but its 3 byte pixels
+// have to be shuffled apart to blend them with SIMD. RGBX pixels are 32 bit words that split into channels with
+// shifts and masks, and planar images have a plane of bytes for each channel that SIMD loads directly.
+enum class PixelLayout
+{
+    RGB,
+    RGBX,
+    Planar
+};
+
+int BytesPerPixel(PixelLayout layout)
+{
+    // a planar image has a byte per pixel in each plane
+    return layout == PixelLayout::RGB ? 3 : (layout == PixelLayout::RGBX ? 4 : 1);
+}
+
+// A width x height image with rows stride pixels apart, so it can be a part of a bigger image. The view doesn't own
+// the pixels.
+struct ImageView
+{
+    unsigned char* pixels;  // the top left pixel, which for planar images is in the R plane
+    int width, height, stride;
+    PixelLayout layout;
+    size_t planeSize;       // for planar images, the bytes from one plane to the next
+
+    unsigned char* PixelAddress(int x, int y) const
+    {
+        return pixels + (size_t(y) * stride + x) * BytesPerPixel(layout);
+    }
+
+    // the subWidth x subHeight part of this image with its top left corner at (x, y)
+    ImageView SubImage(int x, int y, int subWidth, int subHeight) const
+    {
+        ImageView view = *this;
+        view.pixels = PixelAddress(x, y);
+        view.width = subWidth;
+        view.height = subHeight;
+        return view;
+    }
+};
+
+// An image that owns its pixels, in any layout. Assigning an image to one that is already as big reuses its memory.
+struct Image
+{
+    void Resize(int newWidth, int newHeight, PixelLayout newLayout, RGB fillColor)
+    {
+        width = newWidth;
+        height = newHeight;
+        layout = newLayout;
+        data.resize(PixelCount() * (layout == PixelLayout::Planar ? 3 : BytesPerPixel(layout)));
+        for (size_t index = 0; index < PixelCount(); ++index)
+            SetPixel(index, fillColor);
+    }
+
+    size_t PixelCount() const
+    {
+        return size_t(width) * size_t(height);
+    }
+
+    ImageView View()
+    {
+        return ImageView{ data.data(), width, height, width, layout, PixelCount() };
+    }
+
+    // pixels are indexed by y * width + x
+    RGB GetPixel(size_t index) const
+    {
+        switch (layout)
+        {
+            case PixelLayout::RGBX: return RGB{ data[index * 4], data[index * 4 + 1], data[index * 4 + 2] };
+            case PixelLayout::Planar: return RGB{ data[index], data[PixelCount() + index], data[PixelCount() * 2 + index] };
+            default: return RGB{ data[index * 3], data[index * 3 + 1], data[index * 3 + 2] };
+        }
+    }
+
+    void SetPixel(size_t index, RGB color)
+    {
+        switch (layout)
+        {
+            case PixelLayout::RGBX:
+                data[index * 4] = color.R;
+                data[index * 4 + 1] = color.G;
+                data[index * 4 + 2] = color.B;
+                data[index * 4 + 3] = 0;
+                break;
+            case PixelLayout::Planar:
+                data[index] = color.R;
+                data[PixelCount() + index] = color.G;
+                data[PixelCount() * 2 + index] = color.B;
+                break;
+            default:
+                data[index * 3] = color.R;
+                data[index * 3 + 1] = color.G;
+                data[index * 3 + 2] = color.B;
+                break;
+        }
+    }
+
+    // the pixels as packed RGB, for image writers
+    void ToRGB(std::vector<RGB>& rgb) const
+    {
+        rgb.resize(PixelCount());
+        const unsigned char* source = data.data();
+        switch (layout)
+        {
+            case PixelLayout::RGBX:
+                for (size_t index = 0; index < PixelCount(); ++index)
+                    rgb[index] = RGB{ source[index * 4], source[index * 4 + 1], source[index * 4 + 2] };
+                break;
+            case PixelLayout::Planar:
+                for (size_t index = 0; index < PixelCount(); ++index)
+                    rgb[index] = RGB{ source[index], source[PixelCount() + index], source[PixelCount() * 2 + index] };
+                break;
+            default:
+                memcpy(rgb.data(), source, data.size());
+                break;
+        }
+    }
+
+    PixelLayout layout = PixelLayout::RGB;
+    int width = 0, height = 0;
+    std::vector<unsigned char> data;
+};
+
 float SmoothStep(float value, float min, float max)
 {
     float x = (value - min) / (max - min);
     x = std::min(x, 1.0f);
     x = std::max(x, 0.0f);
 
-    return 3.0f * x * x - 2.0f * x * x * x;
-}
+    return 3.0f * x * x - 2.0f * x * x * x;
+}
+
+template <typename T>
+T Lerp(T A, T B, float t)
+{
+    return T(float(A) * (1.0f - t) + float(B) * t);
+}
+
+// Shapes are drawn a span of a row at a time. A kernel works out the alpha of each pixel of the span, then another
+// blends the color into the pixels by those alphas. Both come in SSE4.1 and AVX2 versions which are picked at
+// runtime, and give the same results as the scalar versions they are based on.
+
+enum class DrawSIMD
+{
+    Scalar,
+    SSE41,
+    AVX2
+};
+
+DrawSIMD GetDrawSIMD()
+{
+    static const DrawSIMD drawSIMD = CPUSupportsAVX2() ? DrawSIMD::AVX2 : (CPUSupportsSSE41() ? DrawSIMD::SSE41 : DrawSIMD::Scalar);
+    return drawSIMD;
+}
+
+// spans are done in chunks of this many pixels, so the alphas fit in a buffer on the stack
+static const int c_drawChunkSize = 256;
+
+// a line segment starting at (x1,y1), with its direction AB normalized
+struct LineShape
+{
+    int x1, y1;
+    float ABX, ABY, ABLen;
+};
+
+struct CircleShape
+{
+    int cx, cy, radius;
+    bool filled;
+};
+
+float ShapeAlpha(const LineShape& line, int ix, int iy)
+{
+    // project this current pixel onto the line segment to get the closest point on the line segment to the point
+    float ACX = float(ix - line.x1);
+    float ACY = float(iy - line.y1);
+    float lineSegmentT = ACX * line.ABX + ACY * line.ABY;
+    lineSegmentT = std::min(lineSegmentT, line.ABLen);
+    lineSegmentT = std::max(lineSegmentT, 0.0f);
+    float closestX = float(line.x1) + lineSegmentT * line.ABX;
+    float closestY = float(line.y1) + lineSegmentT * line.ABY;
+
+    // calculate the distance from this pixel to the closest point on the line segment
+    float distanceX = float(ix) - closestX;
+    float distanceY = float(iy) - closestY;
+    float distance = std::sqrtf(distanceX*distanceX + distanceY * distanceY);
+
+    // use the distance to figure out how transparent the pixel should be
+    return SmoothStep(distance, 2.0f, 0.0f);
+}
+
+float ShapeAlpha(const CircleShape& circle, int ix, int iy)
+{
+    float dy = float(circle.cy - iy);
+    float dx = float(circle.cx - ix);
+
+    // distance to the edge for an outline, or to the inside for a filled circle
+    float distance = std::sqrtf(dx * dx + dy * dy) - float(circle.radius);
+    distance = circle.filled ? std::max(distance, 0.0f) : abs(distance);
+
+    return SmoothStep(distance, 2.0f, 0.0f);
+}
+
+template <typename SHAPE>
+void ShapeAlphaRowScalar(const SHAPE& shape, int iy, int startX, int count, float* alpha)
+{
+    for (int index = 0; index < count; ++index)
+        alpha[index] = ShapeAlpha(shape, startX + index, iy);
+}
+
+void BlendRowScalar(RGB* pixels, const float* alpha, int count, RGB color)
+{
+    for (int index = 0; index < count; ++index)
+    {
+        if (alpha[index] > 0.0f)
+        {
+            pixels[index].R = Lerp(pixels[index].R, color.R, alpha[index]);
+            pixels[index].G = Lerp(pixels[index].G, color.G, alpha[index]);
+            pixels[index].B = Lerp(pixels[index].B, color.B, alpha[index]);
+        }
+    }
+}
+
+void BlendRowRGBXScalar(unsigned char* pixels, const float* alpha, int count, RGB color)
+{
+    for (int index = 0; index < count; ++index)
+    {
+        if (alpha[index] > 0.0f)
+        {
+            unsigned char* pixel = pixels + index * 4;
+            pixel[0] = Lerp(pixel[0], color.R, alpha[index]);
+            pixel[1] = Lerp(pixel[1], color.G, alpha[index]);
+            pixel[2] = Lerp(pixel[2], color.B, alpha[index]);
+        }
+    }
+}
+
+// blends one plane of a planar image
+void BlendPlaneRowScalar(unsigned char* channel, const float* alpha, int count, unsigned char color)
+{
+    for (int index = 0; index < count; ++index)
+    {
+        if (alpha[index] > 0.0f)
+            channel[index] = Lerp(channel[index], color, alpha[index]);
+    }
+}
+
+#if CPU_X86
+
+// splits 8 RGB pixels, given as 16 + 8 bytes, into 8 bytes of each channel
+TARGET_SSE41 void DeinterleaveRGB8(__m128i lo, __m128i hi, __m128i& r, __m128i& g, __m128i& b)
+{
+    r = _mm_or_si128(
+        _mm_shuffle_epi8(lo, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(hi, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, -1, -1, -1, -1, -1, -1, -1, -1))
+    );
+    g = _mm_or_si128(
+        _mm_shuffle_epi8(lo, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(hi, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, -1, -1, -1, -1, -1, -1, -1, -1))
+    );
+    b = _mm_or_si128(
+        _mm_shuffle_epi8(lo, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(hi, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1))
+    );
+}
+
+// the reverse of DeinterleaveRGB8
+TARGET_SSE41 void InterleaveRGB8(__m128i r, __m128i g, __m128i b, __m128i& lo, __m128i& hi)
+{
+    __m128i rg = _mm_unpacklo_epi64(r, g);
+    lo = _mm_or_si128(
+        _mm_shuffle_epi8(rg, _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5)),
+        _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1))
+    );
+    hi = _mm_or_si128(
+        _mm_shuffle_epi8(rg, _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(b, _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1))
+    );
+}
+
+TARGET_SSE41 __m128 SmoothStepSSE41(__m128 value, float min, float max)
+{
+    __m128 x = _mm_div_ps(_mm_sub_ps(value, _mm_set1_ps(min)), _mm_set1_ps(max - min));
+    x = _mm_min_ps(x, _mm_set1_ps(1.0f));
+    x = _mm_max_ps(x, _mm_setzero_ps());
+
+    __m128 threeXX = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(3.0f), x), x);
+    __m128 twoXXX = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2.0f), x), x), x);
+    return _mm_sub_ps(threeXX, twoXXX);
+}
+
+TARGET_SSE41 void ShapeAlphaRowSSE41(const LineShape& line, int iy, int startX, int count, float* alpha)
+{
+    const __m128 ABX = _mm_set1_ps(line.ABX);
+    const __m128 ABY = _mm_set1_ps(line.ABY);
+    const __m128 ABLen = _mm_set1_ps(line.ABLen);
+    const __m128 x1 = _mm_set1_ps(float(line.x1));
+    const __m128 y1 = _mm_set1_ps(float(line.y1));
+    const __m128 y = _mm_set1_ps(float(iy));
+    const __m128 ACY = _mm_set1_ps(float(iy - line.y1));
+    const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+    int index = 0;
+    for (; index + 4 <= count; index += 4)
+    {
+        __m128 x = _mm_add_ps(_mm_set1_ps(float(startX + index)), laneOffsets);
+        __m128 ACX = _mm_sub_ps(x, x1);
+        __m128 lineSegmentT = _mm_add_ps(_mm_mul_ps(ACX, ABX), _mm_mul_ps(ACY, ABY));
+        lineSegmentT = _mm_min_ps(lineSegmentT, ABLen);
+        lineSegmentT = _mm_max_ps(lineSegmentT, _mm_setzero_ps());
+        __m128 distanceX = _mm_sub_ps(x, _mm_add_ps(x1, _mm_mul_ps(lineSegmentT, ABX)));
+        __m128 distanceY = _mm_sub_ps(y, _mm_add_ps(y1, _mm_mul_ps(lineSegmentT, ABY)));
+        __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(distanceX, distanceX), _mm_mul_ps(distanceY, distanceY)));
+        _mm_storeu_ps(alpha + index, SmoothStepSSE41(distance, 2.0f, 0.0f));
+    }
+    ShapeAlphaRowScalar(line, iy, startX + index, count - index, alpha + index);
+}
+
+TARGET_SSE41 void ShapeAlphaRowSSE41(const CircleShape& circle, int iy, int startX, int count, float* alpha)
+{
+    const __m128 dy = _mm_set1_ps(float(circle.cy - iy));
+    const __m128 dyy = _mm_mul_ps(dy, dy);
+    const __m128 cx = _mm_set1_ps(float(circle.cx));
+    const __m128 radius = _mm_set1_ps(float(circle.radius));
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+    int index = 0;
+    for (; index + 4 <= count; index += 4)
+    {
+        __m128 dx = _mm_sub_ps(cx, _mm_add_ps(_mm_set1_ps(float(startX + index)), laneOffsets));
+        __m128 distance = _mm_sub_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), dyy)), radius);
+        distance = circle.filled ? _mm_max_ps(distance, _mm_setzero_ps()) : _mm_andnot_ps(signMask, distance);
+        _mm_storeu_ps(alpha + index, SmoothStepSSE41(distance, 2.0f, 0.0f));
+    }
+    ShapeAlphaRowScalar(circle, iy, startX + index, count - index, alpha + index);
+}
+
+// Lerp of 4 channel values, given as the low 4 bytes, towards color, for the lanes where mask is set
+TARGET_SSE41 __m128i BlendChannelSSE41(__m128i channel, float color, __m128 alpha, __m128 mask)
+{
+    __m128 value = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(channel));
+    __m128 blended = _mm_add_ps(_mm_mul_ps(value, _mm_sub_ps(_mm_set1_ps(1.0f), alpha)), _mm_mul_ps(_mm_set1_ps(color), alpha));
+    return _mm_cvttps_epi32(_mm_blendv_ps(value, blended, mask));
+}
+
+TARGET_SSE41 void BlendRowSSE41(RGB* pixels, const float* alpha, int count, RGB color)
+{
+    const __m128 zero = _mm_setzero_ps();
+
+    int index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        __m128 alphaLo = _mm_loadu_ps(alpha + index);
+        __m128 alphaHi = _mm_loadu_ps(alpha + index + 4);
+        __m128 maskLo = _mm_cmpgt_ps(alphaLo, zero);
+        __m128 maskHi = _mm_cmpgt_ps(alphaHi, zero);
+        if (_mm_movemask_ps(_mm_or_ps(maskLo, maskHi)) == 0)
+            continue;
+
+        unsigned char* bytes = (unsigned char*)(pixels + index);
+        __m128i channels[3];
+        DeinterleaveRGB8(_mm_loadu_si128((const __m128i*)bytes), _mm_loadl_epi64((const __m128i*)(bytes + 16)), channels[0], channels[1], channels[2]);
+
+        const float colors[3] = { float(color.R), float(color.G), float(color.B) };
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            __m128i lo = BlendChannelSSE41(channels[channel], colors[channel], alphaLo, maskLo);
+            __m128i hi = BlendChannelSSE41(_mm_srli_si128(channels[channel], 4), colors[channel], alphaHi, maskHi);
+            __m128i packed = _mm_packus_epi32(lo, hi);
+            channels[channel] = _mm_packus_epi16(packed, packed);
+        }
+
+        __m128i lo, hi;
+        InterleaveRGB8(channels[0], channels[1], channels[2], lo, hi);
+        _mm_storeu_si128((__m128i*)bytes, lo);
+        _mm_storel_epi64((__m128i*)(bytes + 16), hi);
+    }
+    BlendRowScalar(pixels + index, alpha + index, count - index, color);
+}
+
+// Lerp of the channel at bit shift of 4 RGBX pixels towards color, for the lanes where mask is set
+TARGET_SSE41 __m128i BlendRGBXChannelSSE41(__m128i pixels, int shift, float color, __m128 alpha, __m128 mask)
+{
+    __m128 value = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, shift), _mm_set1_epi32(0xFF)));
+    __m128 blended = _mm_add_ps(_mm_mul_ps(value, _mm_sub_ps(_mm_set1_ps(1.0f), alpha)), _mm_mul_ps(_mm_set1_ps(color), alpha));
+    return _mm_slli_epi32(_mm_cvttps_epi32(_mm_blendv_ps(value, blended, mask)), shift);
+}
+
+TARGET_SSE41 void BlendRowRGBXSSE41(unsigned char* pixels, const float* alpha, int count, RGB color)
+{
+    int index = 0;
+    for (; index + 4 <= count; index += 4)
+    {
+        __m128 alpha4 = _mm_loadu_ps(alpha + index);
+        __m128 mask = _mm_cmpgt_ps(alpha4, _mm_setzero_ps());
+        if (_mm_movemask_ps(mask) == 0)
+            continue;
+
+        __m128i* address = (__m128i*)(pixels + index * 4);
+        __m128i pixels4 = _mm_loadu_si128(address);
+        __m128i r = BlendRGBXChannelSSE41(pixels4, 0, float(color.R), alpha4, mask);
+        __m128i g = BlendRGBXChannelSSE41(pixels4, 8, float(color.G), alpha4, mask);
+        __m128i b = BlendRGBXChannelSSE41(pixels4, 16, float(color.B), alpha4, mask);
+        __m128i x = _mm_and_si128(pixels4, _mm_set1_epi32(int(0xFF000000)));
+        _mm_storeu_si128(address, _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, x)));
+    }
+    BlendRowRGBXScalar(pixels + index * 4, alpha + index, count - index, color);
+}
+
+TARGET_SSE41 void BlendPlaneRowSSE41(unsigned char* channel, const float* alpha, int count, unsigned char color)
+{
+    const __m128 zero = _mm_setzero_ps();
+
+    int index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        __m128 alphaLo = _mm_loadu_ps(alpha + index);
+        __m128 alphaHi = _mm_loadu_ps(alpha + index + 4);
+        __m128 maskLo = _mm_cmpgt_ps(alphaLo, zero);
+        __m128 maskHi = _mm_cmpgt_ps(alphaHi, zero);
+        if (_mm_movemask_ps(_mm_or_ps(maskLo, maskHi)) == 0)
+            continue;
+
+        __m128i values = _mm_loadl_epi64((const __m128i*)(channel + index));
+        __m128i lo = BlendChannelSSE41(values, float(color), alphaLo, maskLo);
+        __m128i hi = BlendChannelSSE41(_mm_srli_si128(values, 4), float(color), alphaHi, maskHi);
+        __m128i packed = _mm_packus_epi32(lo, hi);
+        _mm_storel_epi64((__m128i*)(channel + index), _mm_packus_epi16(packed, packed));
+    }
+    BlendPlaneRowScalar(channel + index, alpha + index, count - index, color);
+}
+
+TARGET_AVX2 __m256 SmoothStepAVX2(__m256 value, float min, float max)
+{
+    __m256 x = _mm256_div_ps(_mm256_sub_ps(value, _mm256_set1_ps(min)), _mm256_set1_ps(max - min));
+    x = _mm256_min_ps(x, _mm256_set1_ps(1.0f));
+    x = _mm256_max_ps(x, _mm256_setzero_ps());
+
+    __m256 threeXX = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(3.0f), x), x);
+    __m256 twoXXX = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), x), x), x);
+    return _mm256_sub_ps(threeXX, twoXXX);
+}
+
+TARGET_AVX2 void ShapeAlphaRowAVX2(const LineShape& line, int iy, int startX, int count, float* alpha)
+{
+    const __m256 ABX = _mm256_set1_ps(line.ABX);
+    const __m256 ABY = _mm256_set1_ps(line.ABY);
+    const __m256 ABLen = _mm256_set1_ps(line.ABLen);
+    const __m256 x1 = _mm256_set1_ps(float(line.x1));
+    const __m256 y1 = _mm256_set1_ps(float(line.y1));
+    const __m256 y = _mm256_set1_ps(float(iy));
+    const __m256 ACY = _mm256_set1_ps(float(iy - line.y1));
+    const __m256 laneOffsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+    int index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        __m256 x = _mm256_add_ps(_mm256_set1_ps(float(startX + index)), laneOffsets);
+        __m256 ACX = _mm256_sub_ps(x, x1);
+        __m256 lineSegmentT = _mm256_add_ps(_mm256_mul_ps(ACX, ABX), _mm256_mul_ps(ACY, ABY));
+        lineSegmentT = _mm256_min_ps(lineSegmentT, ABLen);
+        lineSegmentT = _mm256_max_ps(lineSegmentT, _mm256_setzero_ps());
+        __m256 distanceX = _mm256_sub_ps(x, _mm256_add_ps(x1, _mm256_mul_ps(lineSegmentT, ABX)));
+        __m256 distanceY = _mm256_sub_ps(y, _mm256_add_ps(y1, _mm256_mul_ps(lineSegmentT, ABY)));
+        __m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(distanceX, distanceX), _mm256_mul_ps(distanceY, distanceY)));
+        _mm256_storeu_ps(alpha + index, SmoothStepAVX2(distance, 2.0f, 0.0f));
+    }
+    ShapeAlphaRowScalar(line, iy, startX + index, count - index, alpha + index);
+}
+
+TARGET_AVX2 void ShapeAlphaRowAVX2(const CircleShape& circle, int iy, int startX, int count, float* alpha)
+{
+    const __m256 dy = _mm256_set1_ps(float(circle.cy - iy));
+    const __m256 dyy = _mm256_mul_ps(dy, dy);
+    const __m256 cx = _mm256_set1_ps(float(circle.cx));
+    const __m256 radius = _mm256_set1_ps(float(circle.radius));
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 laneOffsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+    int index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        __m256 dx = _mm256_sub_ps(cx, _mm256_add_ps(_mm256_set1_ps(float(startX + index)), laneOffsets));
+        __m256 distance = _mm256_sub_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), dyy)), radius);
+        distance = circle.filled ? _mm256_max_ps(distance, _mm256_setzero_ps()) : _mm256_andnot_ps(signMask, distance);
+        _mm256_storeu_ps(alpha + index, SmoothStepAVX2(distance, 2.0f, 0.0f));
+    }
+    ShapeAlphaRowScalar(circle, iy, startX + index, count - index, alpha + index);
+}
+
+// Lerp of 8 channel values, given as the low 8 bytes, towards color, for the lanes where mask is set
+TARGET_AVX2 __m128i BlendChannelAVX2(__m128i channel, float color, __m256 alpha, __m256 mask)
+{
+    __m256 value = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(channel));
+    __m256 blended = _mm256_add_ps(_mm256_mul_ps(value, _mm256_sub_ps(_mm256_set1_ps(1.0f), alpha)), _mm256_mul_ps(_mm256_set1_ps(color), alpha));
+    __m256i result = _mm256_cvttps_epi32(_mm256_blendv_ps(value, blended, mask));
+    __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+    return _mm_packus_epi16(packed, packed);
+}
+
+TARGET_AVX2 void BlendRowAVX2(RGB* pixels, const float* alpha, int count, RGB color)
+{
+    int index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        __m256 alpha8 = _mm256_loadu_ps(alpha + index);
+        __m256 mask = _mm256_cmp_ps(alpha8, _mm256_setzero_ps(), _CMP_GT_OQ);
+        if (_mm256_movemask_ps(mask) == 0)
+            continue;
+
+        unsigned char* bytes = (unsigned char*)(pixels + index);
+        __m128i r, g, b;
+        DeinterleaveRGB8(_mm_loadu_si128((const __m128i*)bytes), _mm_loadl_epi64((const __m128i*)(bytes + 16)), r, g, b);
+
+        r = BlendChannelAVX2(r, float(color.R), alpha8, mask);
+        g = BlendChannelAVX2(g, float(color.G), alpha8, mask);
+        b = BlendChannelAVX2(b, float(color.B), alpha8, mask);
+
+        __m128i lo, hi;
+        InterleaveRGB8(r, g, b, lo, hi);
+        _mm_storeu_si128((__m128i*)bytes, lo);
+        _mm_storel_epi64((__m128i*)(bytes + 16), hi);
+    }
+    BlendRowScalar(pixels + index, alpha + index, count - index, color);
+}
+
+// Lerp of the channel at bit shift of 8 RGBX pixels towards color, for the lanes where mask is set
+TARGET_AVX2 __m256i BlendRGBXChannelAVX2(__m256i pixels, int shift, float color, __m256 alpha, __m256 mask)
+{
+    __m256 value = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, shift), _mm256_set1_epi32(0xFF)));
+    __m256 blended = _mm256_add_ps(_mm256_mul_ps(value, _mm256_sub_ps(_mm256_set1_ps(1.0f), alpha)), _mm256_mul_ps(_mm256_set1_ps(color), alpha));
+    return _mm256_slli_epi32(_mm256_cvttps_epi32(_mm256_blendv_ps(value, blended, mask)), shift);
+}
+
+TARGET_AVX2 void BlendRowRGBXAVX2(unsigned char* pixels, const float* alpha, int count, RGB color)
+{
+    int index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        __m256 alpha8 = _mm256_loadu_ps(alpha + index);
+        __m256 mask = _mm256_cmp_ps(alpha8, _mm256_setzero_ps(), _CMP_GT_OQ);
+        if (_mm256_movemask_ps(mask) == 0)
+            continue;
+
+        __m256i* address = (__m256i*)(pixels + index * 4);
+        __m256i pixels8 = _mm256_loadu_si256(address);
+        __m256i r = BlendRGBXChannelAVX2(pixels8, 0, float(color.R), alpha8, mask);
+        __m256i g = BlendRGBXChannelAVX2(pixels8, 8, float(color.G), alpha8, mask);
+        __m256i b = BlendRGBXChannelAVX2(pixels8, 16, float(color.B), alpha8, mask);
+        __m256i x = _mm256_and_si256(pixels8, _mm256_set1_epi32(int(0xFF000000)));
+        _mm256_storeu_si256(address, _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, x)));
+    }
+    BlendRowRGBXScalar(pixels + index * 4, alpha + index, count - index, color);
+}
+
+TARGET_AVX2 void BlendPlaneRowAVX2(unsigned char* channel, const float* alpha, int count, unsigned char color)
+{
+    int index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        __m256 alpha8 = _mm256_loadu_ps(alpha + index);
+        __m256 mask = _mm256_cmp_ps(alpha8, _mm256_setzero_ps(), _CMP_GT_OQ);
+        if (_mm256_movemask_ps(mask) == 0)
+            continue;
+
+        __m128i values = _mm_loadl_epi64((const __m128i*)(channel + index));
+        _mm_storel_epi64((__m128i*)(channel + index), BlendChannelAVX2(values, float(color), alpha8, mask));
+    }
+    BlendPlaneRowScalar(channel + index, alpha + index, count - index, color);
+}
+
+#endif
+
+// the alphas of count pixels of row iy of a shape, starting at startX, using the best kernel the CPU supports
+template <typename SHAPE>
+void ShapeAlphaRow(const SHAPE& shape, int iy, int startX, int count, float* alpha)
+{
+    switch (GetDrawSIMD())
+    {
+#if CPU_X86
+        case DrawSIMD::AVX2: ShapeAlphaRowAVX2(shape, iy, startX, count, alpha); break;
+        case DrawSIMD::SSE41: ShapeAlphaRowSSE41(shape, iy, startX, count, alpha); break;
+#endif
+        default: ShapeAlphaRowScalar(shape, iy, startX, count, alpha); break;
+    }
+}
+
+void BlendRow(RGB* pixels, const float* alpha, int count, RGB color)
+{
+    switch (GetDrawSIMD())
+    {
+#if CPU_X86
+        case DrawSIMD::AVX2: BlendRowAVX2(pixels, alpha, count, color); break;
+        case DrawSIMD::SSE41: BlendRowSSE41(pixels, alpha, count, color); break;
+#endif
+        default: BlendRowScalar(pixels, alpha, count, color); break;
+    }
+}
+
+void BlendRowRGBX(unsigned char* pixels, const float* alpha, int count, RGB color)
+{
+    switch (GetDrawSIMD())
+    {
+#if CPU_X86
+        case DrawSIMD::AVX2: BlendRowRGBXAVX2(pixels, alpha, count, color); break;
+        case DrawSIMD::SSE41: BlendRowRGBXSSE41(pixels, alpha, count, color); break;
+#endif
+        default: BlendRowRGBXScalar(pixels, alpha, count, color); break;
+    }
+}
+
+void BlendPlaneRow(unsigned char* channel, const float* alpha, int count, unsigned char color)
+{
+    switch (GetDrawSIMD())
+    {
+#if CPU_X86
+        case DrawSIMD::AVX2: BlendPlaneRowAVX2(channel, alpha, count, color); break;
+        case DrawSIMD::SSE41: BlendPlaneRowSSE41(channel, alpha, count, color); break;
+#endif
+        default: BlendPlaneRowScalar(channel, alpha, count, color); break;
+    }
+}
+
+// blends count pixels of row y of an image, starting at x, towards color by their alphas
+void BlendRow(const ImageView& image, int x, int y, const float* alpha, int count, RGB color)
+{
+    unsigned char* pixels = image.PixelAddress(x, y);
+    switch (image.layout)
+    {
+        case PixelLayout::RGBX:
+            BlendRowRGBX(pixels, alpha, count, color);
+            break;
+        case PixelLayout::Planar:
+            BlendPlaneRow(pixels, alpha, count, color.R);
+            BlendPlaneRow(pixels + image.planeSize, alpha, count, color.G);
+            BlendPlaneRow(pixels + image.planeSize * 2, alpha, count, color.B);
+            break;
+        default:
+            BlendRow((RGB*)pixels, alpha, count, color);
+            break;
+    }
+}
+
+// draws the pixels [startX, endX] of row iy of a shape
+template <typename SHAPE>
+void DrawShapeSpan(const ImageView& image, const SHAPE& shape, int iy, int startX, int endX, RGB color)
+{
+    float alpha[c_drawChunkSize];
+    for (int chunkStartX = startX; chunkStartX <= endX; chunkStartX += c_drawChunkSize)
+    {
+        int count = std::min(c_drawChunkSize, endX + 1 - chunkStartX);
+        ShapeAlphaRow(shape, iy, chunkStartX, count, alpha);
+        BlendRow(image, chunkStartX, iy, alpha, count, color);
+    }
+}
+
+// Narrows [spanMin, spanMax] to the x where c * x + k is in [low, high]
+void IntersectLinearConstraint(double c, double k, double low, double high, double& spanMin, double& spanMax)
+{
+    if (c == 0.0)
+    {
+        if (k < low || k > high)
+        {
+            spanMin = 1.0;
+            spanMax = 0.0;
+        }
+        return;
+    }
+
+    double a = (low - k) / c;
+    double b = (high - k) / c;
+    spanMin = std::max(spanMin, std::min(a, b));
+    spanMax = std::min(spanMax, std::max(a, b));
+}
+
+// Finds the x range of row y that is within radius of the line segment from (x1,y1) to (x2,y2). Returns false if
+// there isn't any. The points within radius of a segment are a disc at each end joined by a rectangle, and that
+// shape is convex, so the row crosses it in a single span which is the union of where it crosses each part.
+bool LineSegmentRowSpan(int x1, int y1, int x2, int y2, double radius, int y, double& spanMin, double& spanMax)
+{
+    spanMin = DBL_MAX;
+    spanMax = -DBL_MAX;
+
+    // the discs at the end points
+    int endPoints[2][2] = { { x1, y1 }, { x2, y2 } };
+    for (const int* endPoint : endPoints)
+    {
+        double dy = double(y - endPoint[1]);
+        if (std::abs(dy) < radius)
+        {
+            double halfWidth = std::sqrt(radius * radius - dy * dy);
+            spanMin = std::min(spanMin, endPoint[0] - halfWidth);
+            spanMax = std::max(spanMax, endPoint[0] + halfWidth);
+        }
+    }
+
+    // the rectangle, which is the points that project onto the segment and are within radius of the line through it
+    double ABX = double(x2 - x1);
+    double ABY = double(y2 - y1);
+    double ABLen = std::sqrt(ABX * ABX + ABY * ABY);
+    if (ABLen > 0.0)
+    {
+        ABX /= ABLen;
+        ABY /= ABLen;
+        double ACY = double(y - y1);
+        double rectangleMin = -DBL_MAX, rectangleMax = DBL_MAX;
+        IntersectLinearConstraint(ABX, ABY * ACY - ABX * x1, 0.0, ABLen, rectangleMin, rectangleMax);
+        IntersectLinearConstraint(-ABY, ABX * ACY + ABY * x1, -radius, radius, rectangleMin, rectangleMax);
+        if (rectangleMin <= rectangleMax)
+        {
+            spanMin = std::min(spanMin, rectangleMin);
+            spanMax = std::max(spanMax, rectangleMax);
+        }
+    }
 
-template <typename T>
-T Lerp(T A, T B, float t)
-{
-    return T(float(A) * (1.0f - t) + float(B) * t);
+    return spanMin <= spanMax;
 }
 
-void DrawLine(std::vector<RGB>& image, int width, int height, int x1, int y1, int x2, int y2, RGB color)
+// Calls spanFunc(line, iy, startX, endX) for the span of pixels on each row of the image that a line segment
+// from (x1,y1) to (x2,y2) can draw to.
+template <typename SPAN_FUNC>
+void ForEachLineSpan(int width, int height, int x1, int y1, int x2, int y2, const SPAN_FUNC& spanFunc)
 {
     // pad the AABB of pixels we scan, to account for anti aliasing
     int startX = std::max(std::min(x1, x2) - 4, 0);
@@ -153,325 +1270,935 @@ void DrawLine(std::vector<RGB>& image, int width, int height, int x1, int y1, in
     ABX /= ABLen;
     ABY /= ABLen;
 
-    // scan the AABB of our line segment, drawing pixels for the line, as is appropriate
+    // a zero length line has no direction, and its pixels all come out with an alpha of NaN, which draws nothing
+    if (ABLen == 0.0f)
+        return;
+
+    LineShape line = { x1, y1, ABX, ABY, ABLen };
+
+    // the line's alpha is 0 for pixels this far from it or further
+    static const double c_lineRadius = 2.0;
+
+    // scan the rows of the AABB of our line segment, only visiting the span of pixels on each row that are close
+    // enough to the line to be drawn. The span is widened by a pixel on each side so float rounding can't clip it.
     for (int iy = startY; iy <= endY; ++iy)
     {
-        RGB* pixel = &image[(iy * width + startX)];
-        for (int ix = startX; ix <= endX; ++ix)
+        double spanMin, spanMax;
+        if (!LineSegmentRowSpan(x1, y1, x2, y2, c_lineRadius, iy, spanMin, spanMax))
+            continue;
+        int spanStartX = std::max(int(std::floor(std::max(spanMin, double(startX)))) - 1, startX);
+        int spanEndX = std::min(int(std::ceil(std::min(spanMax, double(endX)))) + 1, endX);
+
+        spanFunc(line, iy, spanStartX, spanEndX);
+    }
+}
+
+void DrawLine(const ImageView& image, int x1, int y1, int x2, int y2, RGB color)
+{
+    ForEachLineSpan(image.width, image.height, x1, y1, x2, y2,
+        [&](const LineShape& line, int iy, int startX, int endX)
         {
-            // project this current pixel onto the line segment to get the closest point on the line segment to the point
-            float ACX = float(ix - x1);
-            float ACY = float(iy - y1);
-            float lineSegmentT = ACX * ABX + ACY * ABY;
-            lineSegmentT = std::min(lineSegmentT, ABLen);
-            lineSegmentT = std::max(lineSegmentT, 0.0f);
-            float closestX = float(x1) + lineSegmentT * ABX;
-            float closestY = float(y1) + lineSegmentT * ABY;
+            DrawShapeSpan(image, line, iy, startX, endX, color);
+        }
+    );
+}
 
-            // calculate the distance from this pixel to the closest point on the line segment
-            float distanceX = float(ix) - closestX;
-            float distanceY = float(iy) - closestY;
-            float distance = std::sqrtf(distanceX*distanceX + distanceY * distanceY);
+// Finds the pixels of row iy that a circle can draw to, as distances from its center column. Pixels with
+// |ix - cx| <= outerHalfWidth can have an alpha above 0, except the ones with |ix - cx| <= innerHalfWidth, which
+// are too deep inside an outline to be drawn. innerHalfWidth is -1 when the row has no such hole.
+// The widths are estimated from the radius, then nudged a pixel at a time until they agree exactly with ShapeAlpha,
+// which only changes in one direction along each side of the circle. Returns false if the row misses the circle.
+bool CircleRowHalfWidths(const CircleShape& circle, int iy, int& outerHalfWidth, int& innerHalfWidth)
+{
+    // the circle's alpha is 0 for pixels 2 or more pixels out from its edge, or in from it for an outline
+    static const double c_edgeRadius = 2.0;
+
+    double dySquared = double(circle.cy - iy) * double(circle.cy - iy);
+
+    double outerRadius = double(circle.radius) + c_edgeRadius;
+    outerHalfWidth = int(std::sqrt(std::max(outerRadius * outerRadius - dySquared, 0.0)));
+    while (outerHalfWidth >= 0 && ShapeAlpha(circle, circle.cx + outerHalfWidth, iy) <= 0.0f)
+        outerHalfWidth--;
+    while (ShapeAlpha(circle, circle.cx + outerHalfWidth + 1, iy) > 0.0f)
+        outerHalfWidth++;
+    if (outerHalfWidth < 0)
+        return false;
+
+    innerHalfWidth = -1;
+    double innerRadius = double(circle.radius) - c_edgeRadius;
+    if (!circle.filled && innerRadius > 0.0 && innerRadius * innerRadius > dySquared)
+    {
+        innerHalfWidth = int(std::sqrt(innerRadius * innerRadius - dySquared));
+        while (innerHalfWidth >= 0 && ShapeAlpha(circle, circle.cx + innerHalfWidth, iy) > 0.0f)
+            innerHalfWidth--;
+        while (innerHalfWidth + 1 < outerHalfWidth && ShapeAlpha(circle, circle.cx + innerHalfWidth + 1, iy) <= 0.0f)
+            innerHalfWidth++;
+    }
+    return true;
+}
 
-            // use the distance to figure out how transparent the pixel should be, and apply the color to the pixel
-            float alpha = SmoothStep(distance, 2.0f, 0.0f);
+// draws the pixels of a circle on each row, skipping the inside of outlines, so an outline costs O(radius)
+void DrawCircleShape(const ImageView& image, const CircleShape& circle, RGB color)
+{
+    int startX = std::max(circle.cx - circle.radius - 4, 0);
+    int startY = std::max(circle.cy - circle.radius - 4, 0);
+    int endX = std::min(circle.cx + circle.radius + 4, image.width - 1);
+    int endY = std::min(circle.cy + circle.radius + 4, image.height - 1);
 
-            if (alpha > 0.0f)
-            {
-                pixel->R = Lerp(pixel->R, color.R, alpha);
-                pixel->G = Lerp(pixel->G, color.G, alpha);
-                pixel->B = Lerp(pixel->B, color.B, alpha);
-            }
+    for (int iy = startY; iy <= endY; ++iy)
+    {
+        int outerHalfWidth, innerHalfWidth;
+        if (!CircleRowHalfWidths(circle, iy, outerHalfWidth, innerHalfWidth))
+            continue;
 
-            pixel++;
+        int spanStartX = std::max(circle.cx - outerHalfWidth, startX);
+        int spanEndX = std::min(circle.cx + outerHalfWidth, endX);
+        if (innerHalfWidth < 0)
+        {
+            DrawShapeSpan(image, circle, iy, spanStartX, spanEndX, color);
+            continue;
         }
+
+        DrawShapeSpan(image, circle, iy, spanStartX, std::min(circle.cx - innerHalfWidth - 1, endX), color);
+        DrawShapeSpan(image, circle, iy, std::max(circle.cx + innerHalfWidth + 1, startX), spanEndX, color);
     }
 }
 
-void DrawCircleFilled(std::vector<RGB>& image, int width, int height, int cx, int cy, int radius, RGB color)
+void DrawCircleFilled(const ImageView& image, int cx, int cy, int radius, RGB color)
 {
-    int startX = std::max(cx - radius - 4, 0);
-    int startY = std::max(cy - radius - 4, 0);
-    int endX = std::min(cx + radius + 4, width - 1);
-    int endY = std::min(cy + radius + 4, height - 1);
+    DrawCircleShape(image, CircleShape{ cx, cy, radius, true }, color);
+}
 
-    for (int iy = startY; iy <= endY; ++iy)
+void DrawCircle(const ImageView& image, int cx, int cy, int radius, RGB color)
+{
+    DrawCircleShape(image, CircleShape{ cx, cy, radius, false }, color);
+}
+
+// Which samples cover each pixel of an image and by how much, so frames that only differ in the colors of the
+// samples can be made without rasterizing anything. A pixel is resolved by blending the color of each sample that
+// covers it into the background, in the order they were recorded, which gives the same pixels drawing them would.
+// Only covered pixels are stored. They are sorted by how many samples cover them and put in groups of 8, so a
+// group of pixels resolves together in SIMD lanes with little padding.
+struct SampleCoverageBuffer
+{
+    static constexpr int c_groupSize = 8;
+
+    // padding entries use this sample, which is never visible
+    static constexpr uint16_t c_noSample = 0xFFFF;
+
+    struct Entry
     {
-        float dy = float(cy - iy);
-        RGB* pixel = &image[(iy * width + startX)];
-        for (int ix = startX; ix <= endX; ++ix)
+        uint32_t pixelIndex;
+        uint16_t sample;
+        float alpha;
+    };
+
+    // the color of each sample, also kept as floats for the AVX2 resolve to gather
+    struct Palette
+    {
+        void Resize(size_t sampleCount)
+        {
+            colors.resize(sampleCount);
+            r.resize(sampleCount);
+            g.resize(sampleCount);
+            b.resize(sampleCount);
+        }
+
+        void SetColor(size_t sample, RGB color)
         {
-            float dx = float(cx - ix);
+            colors[sample] = color;
+            r[sample] = float(color.R);
+            g[sample] = float(color.G);
+            b[sample] = float(color.B);
+        }
 
-            float distance = std::max(std::sqrtf(dx * dx + dy * dy) - float(radius), 0.0f);
+        std::vector<RGB> colors;
+        std::vector<float> r, g, b;
+    };
+
+    // Records the pixels a line would draw to. Rows of the image are stride pixels apart and pixelOffset is added to
+    // every pixel index, so lines in a sub image can be recorded in the coordinates of a bigger image.
+    // Samples are stored in 16 bits, so sample has to be below c_noSample.
+    static void RecordLine(std::vector<Entry>& entries, int width, int height, int stride, int pixelOffset, int x1, int y1, int x2, int y2, int sample)
+    {
+        assert(sample >= 0 && sample < int(c_noSample));
+        float alpha[c_drawChunkSize];
+        ForEachLineSpan(width, height, x1, y1, x2, y2,
+            [&](const LineShape& line, int iy, int startX, int endX)
+            {
+                for (int chunkStartX = startX; chunkStartX <= endX; chunkStartX += c_drawChunkSize)
+                {
+                    int count = std::min(c_drawChunkSize, endX + 1 - chunkStartX);
+                    ShapeAlphaRow(line, iy, chunkStartX, count, alpha);
+                    for (int index = 0; index < count; ++index)
+                    {
+                        if (alpha[index] > 0.0f)
+                            entries.push_back(Entry{ uint32_t(pixelOffset + iy * stride + chunkStartX + index), uint16_t(sample), alpha[index] });
+                    }
+                }
+            }
+        );
+    }
 
-            float alpha = SmoothStep(distance, 2.0f, 0.0f);
+    // Builds the buffer from entries in the order they were drawn, for an image of pixelCount pixels. Building
+    // again reuses the memory of the last build.
+    void Build(const std::vector<Entry>& entries, size_t pixelCount)
+    {
+        // bucket the entries by pixel, keeping their order
+        pixelStarts.assign(pixelCount + 1, 0);
+        for (const Entry& entry : entries)
+            pixelStarts[entry.pixelIndex + 1]++;
+        for (size_t index = 0; index < pixelCount; ++index)
+            pixelStarts[index + 1] += pixelStarts[index];
+
+        pixelEntries.resize(entries.size());
+        pixelNext.assign(pixelStarts.begin(), pixelStarts.end() - 1);
+        for (const Entry& entry : entries)
+            pixelEntries[pixelNext[entry.pixelIndex]++] = &entry;
+
+        // the covered pixels, most covered first, with a counting sort on how many samples cover them. It keeps
+        // pixels with the same count in order, like a stable sort would, without needing a temporary buffer.
+        uint32_t maxDepth = 0;
+        for (size_t index = 0; index < pixelCount; ++index)
+            maxDepth = std::max(maxDepth, pixelStarts[index + 1] - pixelStarts[index]);
+        depthStarts.assign(maxDepth + 2, 0);
+        for (size_t index = 0; index < pixelCount; ++index)
+            depthStarts[maxDepth - (pixelStarts[index + 1] - pixelStarts[index]) + 1]++;
+        for (uint32_t depth = 0; depth <= maxDepth; ++depth)
+            depthStarts[depth + 1] += depthStarts[depth];
+
+        // pixels that nothing covers sort last, and are left off
+        coveredPixels.resize(depthStarts[maxDepth]);
+        for (size_t index = 0; index < pixelCount; ++index)
+        {
+            uint32_t depth = pixelStarts[index + 1] - pixelStarts[index];
+            if (depth > 0)
+                coveredPixels[depthStarts[maxDepth - depth]++] = uint32_t(index);
+        }
 
-            if (alpha > 0.0f)
+        // lay the groups out as [step][lane], padding shorter pixels in a group with invisible entries
+        pixelCountInGroups = coveredPixels.size();
+        size_t groupCount = (coveredPixels.size() + c_groupSize - 1) / c_groupSize;
+        pixelIndices.assign(groupCount * c_groupSize, 0);
+        groupStarts.assign(groupCount + 1, 0);
+        samples.clear();
+        alphas.clear();
+        for (size_t group = 0; group < groupCount; ++group)
+        {
+            uint32_t depth = 0;
+            for (int lane = 0; lane < c_groupSize; ++lane)
             {
-                pixel->R = Lerp(pixel->R, color.R, alpha);
-                pixel->G = Lerp(pixel->G, color.G, alpha);
-                pixel->B = Lerp(pixel->B, color.B, alpha);
+                size_t coveredIndex = group * c_groupSize + lane;
+                if (coveredIndex >= coveredPixels.size())
+                    break;
+                uint32_t pixelIndex = coveredPixels[coveredIndex];
+                pixelIndices[coveredIndex] = pixelIndex;
+                depth = std::max(depth, pixelStarts[pixelIndex + 1] - pixelStarts[pixelIndex]);
             }
 
-            pixel ++;
+            for (uint32_t step = 0; step < depth; ++step)
+            {
+                for (int lane = 0; lane < c_groupSize; ++lane)
+                {
+                    size_t coveredIndex = group * c_groupSize + lane;
+                    uint32_t pixelIndex = coveredIndex < coveredPixels.size() ? coveredPixels[coveredIndex] : 0;
+                    bool hasEntry = coveredIndex < coveredPixels.size() && pixelStarts[pixelIndex] + step < pixelStarts[pixelIndex + 1];
+                    const Entry* entry = hasEntry ? pixelEntries[pixelStarts[pixelIndex] + step] : nullptr;
+                    samples.push_back(entry ? entry->sample : c_noSample);
+                    alphas.push_back(entry ? entry->alpha : 0.0f);
+                }
+            }
+            groupStarts[group + 1] = uint32_t(samples.size() / c_groupSize);
         }
     }
-}
 
-void DrawCircle(std::vector<RGB>& image, int width, int height, int cx, int cy, int radius, RGB color)
-{
-    int startX = std::max(cx - radius - 4, 0);
-    int startY = std::max(cy - radius - 4, 0);
-    int endX = std::min(cx + radius + 4, width - 1);
-    int endY = std::min(cy + radius + 4, height - 1);
+    // Blends the samples into image, which should start out as the background. The palette has the color of every
+    // sample, and samples after lastVisibleSample aren't drawn.
+    void Resolve(Image& image, const Palette& palette, int lastVisibleSample) const
+    {
+#if CPU_X86
+        if (GetDrawSIMD() == DrawSIMD::AVX2)
+        {
+            ResolveAVX2(image, palette, lastVisibleSample);
+            return;
+        }
+#endif
+        ResolveScalar(image, palette, lastVisibleSample);
+    }
 
-    for (int iy = startY; iy <= endY; ++iy)
+    void ResolveScalar(Image& image, const Palette& palette, int lastVisibleSample) const
     {
-        float dy = float(cy - iy);
-        RGB* pixel = &image[(iy * width + startX)];
-        for (int ix = startX; ix <= endX; ++ix)
+        for (size_t group = 0; group + 1 < groupStarts.size(); ++group)
         {
-            float dx = float(cx - ix);
+            for (int lane = 0; lane < c_groupSize && group * c_groupSize + lane < pixelCountInGroups; ++lane)
+            {
+                uint32_t pixelIndex = pixelIndices[group * c_groupSize + lane];
+                RGB pixel = image.GetPixel(pixelIndex);
+                for (uint32_t step = groupStarts[group]; step < groupStarts[group + 1]; ++step)
+                {
+                    uint16_t sample = samples[step * c_groupSize + lane];
+                    float alpha = alphas[step * c_groupSize + lane];
+                    if (sample == c_noSample || int(sample) > lastVisibleSample || !(alpha > 0.0f))
+                        continue;
+
+                    RGB color = palette.colors[sample];
+                    pixel.R = Lerp(pixel.R, color.R, alpha);
+                    pixel.G = Lerp(pixel.G, color.G, alpha);
+                    pixel.B = Lerp(pixel.B, color.B, alpha);
+                }
+                image.SetPixel(pixelIndex, pixel);
+            }
+        }
+    }
+
+#if CPU_X86
+    // Lerp of 8 channel values towards their colors where mask is set. Lerp turns its result back into a byte, so
+    // the value is truncated after every blend to match it.
+    TARGET_AVX2 static __m256 BlendLanesAVX2(__m256 value, __m256 color, __m256 alpha, __m256 mask)
+    {
+        __m256 blended = _mm256_add_ps(_mm256_mul_ps(value, _mm256_sub_ps(_mm256_set1_ps(1.0f), alpha)), _mm256_mul_ps(color, alpha));
+        blended = _mm256_round_ps(blended, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        return _mm256_blendv_ps(value, blended, mask);
+    }
 
-            float distance = abs(std::sqrtf(dx * dx + dy * dy) - float(radius));
+    TARGET_AVX2 void ResolveAVX2(Image& image, const Palette& palette, int lastVisibleSample) const
+    {
+        // padding entries are c_noSample, which RecordLine keeps above every real sample, so are never visible
+        int visibleLimit = std::min(lastVisibleSample, int(palette.colors.size()) - 1) + 1;
+        const __m256i visibleLimit8 = _mm256_set1_epi32(visibleLimit);
 
-            float alpha = SmoothStep(distance, 2.0f, 0.0f);
+        alignas(32) float r[c_groupSize], g[c_groupSize], b[c_groupSize];
+        for (size_t group = 0; group + 1 < groupStarts.size(); ++group)
+        {
+            const uint32_t* groupPixels = &pixelIndices[group * c_groupSize];
+            int laneCount = int(std::min<size_t>(c_groupSize, pixelCountInGroups - group * c_groupSize));
+            for (int lane = 0; lane < c_groupSize; ++lane)
+            {
+                RGB pixel = image.GetPixel(groupPixels[lane < laneCount ? lane : 0]);
+                r[lane] = float(pixel.R);
+                g[lane] = float(pixel.G);
+                b[lane] = float(pixel.B);
+            }
 
-            if (alpha > 0.0f)
+            __m256 valueR = _mm256_load_ps(r);
+            __m256 valueG = _mm256_load_ps(g);
+            __m256 valueB = _mm256_load_ps(b);
+            for (uint32_t step = groupStarts[group]; step < groupStarts[group + 1]; ++step)
             {
-                pixel->R = Lerp(pixel->R, color.R, alpha);
-                pixel->G = Lerp(pixel->G, color.G, alpha);
-                pixel->B = Lerp(pixel->B, color.B, alpha);
+                __m256i sample8 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&samples[step * c_groupSize]));
+                __m256 alpha8 = _mm256_loadu_ps(&alphas[step * c_groupSize]);
+                __m256 mask = _mm256_and_ps(
+                    _mm256_castsi256_ps(_mm256_cmpgt_epi32(visibleLimit8, sample8)),
+                    _mm256_cmp_ps(alpha8, _mm256_setzero_ps(), _CMP_GT_OQ)
+                );
+                if (_mm256_movemask_ps(mask) == 0)
+                    continue;
+
+                // only the masked lanes are gathered, so invisible samples never index past the palette
+                __m256 colorR = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), palette.r.data(), sample8, mask, 4);
+                __m256 colorG = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), palette.g.data(), sample8, mask, 4);
+                __m256 colorB = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), palette.b.data(), sample8, mask, 4);
+                valueR = BlendLanesAVX2(valueR, colorR, alpha8, mask);
+                valueG = BlendLanesAVX2(valueG, colorG, alpha8, mask);
+                valueB = BlendLanesAVX2(valueB, colorB, alpha8, mask);
             }
+            _mm256_store_ps(r, valueR);
+            _mm256_store_ps(g, valueG);
+            _mm256_store_ps(b, valueB);
 
-            pixel++;
+            for (int lane = 0; lane < laneCount; ++lane)
+                image.SetPixel(groupPixels[lane], RGB{ (unsigned char)r[lane], (unsigned char)g[lane], (unsigned char)b[lane] });
         }
     }
-}
+#endif
+
+    size_t pixelCountInGroups = 0;
+    std::vector<uint32_t> pixelIndices;
+    std::vector<uint32_t> groupStarts;
+    std::vector<uint16_t> samples;
+    std::vector<float> alphas;
+
+    // scratch space for Build, kept so building again doesn't allocate
+    std::vector<uint32_t> pixelStarts;
+    std::vector<const Entry*> pixelEntries;
+    std::vector<uint32_t> pixelNext;
+    std::vector<uint32_t> depthStarts;
+    std::vector<uint32_t> coveredPixels;
+};
 
 float Fract(float x)
 {
     return x - floor(x);
 }
 
-void NumberlineAndCircleTestBN(const char* baseFileName)
+// distance between two values on the [0,1) numberline, wrapping around at the ends
+float ToroidalDistance(float a, float b)
 {
-    static const int c_numFrames = 16;
+    float dist = std::abs(a - b);
+    if (dist > 0.5f)
+        dist = 1.0f - dist;
+    return dist;
+}
 
-    static const int c_circleImageSize = 256;
-    static const int c_circleRadius = 120;
+// deterministic random float in [0,1) for each (seed, stream, index), using the splitmix64 finalizer
+float HashToFloat01(uint64_t seed, uint64_t stream, uint64_t index)
+{
+    uint64_t x = seed ^ (stream * 0x9E3779B97F4A7C15ull) ^ (index * 0xC2B2AE3D27D4EB4Full);
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return float(x >> 40) / 16777216.0f;
+}
 
-    static const int c_numberlineImageWidth = c_circleImageSize;
-    static const int c_numberlineImageHeight = c_numberlineImageWidth / 4;
-    static const int c_numberlineStartX = c_numberlineImageWidth / 10;
-    static const int c_numberlineSizeX = c_numberlineImageWidth * 8 / 10;
-    static const int c_numberlineEndX = c_numberlineStartX + c_numberlineSizeX;
-    static const int c_numberlineLineStartY = (c_numberlineImageHeight / 2) - 10;
-    static const int c_numberlineLineEndY = (c_numberlineImageHeight / 2) + 10;
+// Generates a 1D toroidal blue noise sequence using Mitchell's best candidate algorithm.
+// Accepted values are kept in a bucket grid with roughly one value per bucket, so finding the nearest
+// neighbor of a candidate only looks at a few buckets instead of every value accepted so far.
+struct BlueNoiseSequence1D
+{
+    // Each new value picks the best of (values.size() * candidateMultiplier + 1) candidates, which is the
+    // classic Mitchell's best candidate setup when the multiplier is 1. maxCandidates of 0 means no limit.
+    // If a thread pool is given, candidates are scored in parallel. Candidates then come from a random stream
+    // per candidate instead of one shared mt19937, so the sequence is different from the serial one, but it
+    // is the same for any number of threads.
+    BlueNoiseSequence1D(unsigned int seed, float candidateMultiplier = 1.0f, int maxCandidates = 0, ThreadPool* threadPool = nullptr)
+        : seed(seed)
+        , rng(seed)
+        , dist(0.0f, 1.0f)
+        , candidateMultiplier(candidateMultiplier)
+        , maxCandidates(maxCandidates)
+        , threadPool(threadPool)
+    {
+        RebuildBuckets(1);
+    }
 
-    std::mt19937 rng(0x1337beef);
-    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    // adds the next value to the sequence and returns it. The first value is always 0.
+    float AddValue()
+    {
+        if (values.empty())
+        {
+            Insert(0.0f);
+            return 0.0f;
+        }
 
-    std::vector<float> values;
-    char fileName[256];
-    for (int frame = 0; frame < c_numFrames; ++frame)
+        int candidateCount = int(float(values.size()) * candidateMultiplier) + 1;
+        if (maxCandidates > 0)
+            candidateCount = std::min(candidateCount, maxCandidates);
+
+        if (threadPool)
+        {
+            float bestCandidate = BestCandidateParallel(candidateCount);
+            Insert(bestCandidate);
+            return bestCandidate;
+        }
+
+        float bestCandidate = 0.0f;
+        float bestCandidateScore = -1.0f;
+        for (int candidateIndex = 0; candidateIndex < candidateCount; ++candidateIndex)
+        {
+            float candidate = dist(rng);
+            float score = DistanceToNearest(candidate);
+            if (score > bestCandidateScore)
+            {
+                bestCandidateScore = score;
+                bestCandidate = candidate;
+            }
+        }
+
+        Insert(bestCandidate);
+        return bestCandidate;
+    }
+
+    // returns the toroidal distance from value to the closest value in the sequence, or FLT_MAX if it's empty.
+    float DistanceToNearest(float value) const
     {
-        // Mitchell's best candidate
-        if (frame > 0)
+        int bucketCount = (int)bucketHeads.size();
+        int bucket = BucketIndex(value);
+        float bucketSize = 1.0f / float(bucketCount);
+
+        // search rings of buckets outwards from the value's bucket. After searching ring r, anything not yet
+        // visited is at least r buckets away, so we can stop once we have something that close.
+        float minDist = FLT_MAX;
+        for (int ring = 0; ring * 2 <= bucketCount; ++ring)
         {
-            int candidateCount = frame + 1;
-            float bestCandidate = 0.0f;
-            float bestCandidateScore = -1.0f;
-            for (int candidateIndex = 0; candidateIndex < candidateCount; ++candidateIndex)
+            int ringBuckets[2] = { bucket - ring, bucket + ring };
+            int ringBucketCount = (ring == 0 || ring * 2 == bucketCount) ? 1 : 2;
+            for (int i = 0; i < ringBucketCount; ++i)
             {
-                float candidate = dist(rng);
+                int searchBucket = (ringBuckets[i] + bucketCount) & (bucketCount - 1);
+                for (int index = bucketHeads[searchBucket]; index != -1; index = bucketNext[index])
+                    minDist = std::min(minDist, ToroidalDistance(values[index], value));
+            }
 
-                float minDist = FLT_MAX;
-                for (float f : values)
-                {
-                    float dist = std::abs(f - candidate);
-                    if (dist > 0.5f)
-                        dist = 1.0f - dist;
-                    minDist = std::min(minDist, dist);
-                }
+            if (minDist <= float(ring) * bucketSize)
+                break;
+        }
+        return minDist;
+    }
 
-                if (minDist > bestCandidateScore)
+    std::vector<float> values;
+
+private:
+    struct ScoredCandidate
+    {
+        float candidate;
+        float score;
+    };
+
+    float BestCandidateParallel(int candidateCount)
+    {
+        static const int c_candidatesPerChunk = 256;
+        int chunkCount = (candidateCount + c_candidatesPerChunk - 1) / c_candidatesPerChunk;
+        chunkBest.resize(chunkCount);
+
+        uint64_t valueIndex = values.size();
+        threadPool->ParallelFor(chunkCount,
+            [&](int chunkIndex)
+            {
+                int candidateBegin = chunkIndex * c_candidatesPerChunk;
+                int candidateEnd = std::min(candidateBegin + c_candidatesPerChunk, candidateCount);
+                ScoredCandidate best = { 0.0f, -1.0f };
+                for (int candidateIndex = candidateBegin; candidateIndex < candidateEnd; ++candidateIndex)
                 {
-                    bestCandidateScore = minDist;
-                    bestCandidate = candidate;
+                    float candidate = HashToFloat01(seed, valueIndex, candidateIndex);
+                    float score = DistanceToNearest(candidate);
+                    if (score > best.score)
+                        best = { candidate, score };
                 }
+                chunkBest[chunkIndex] = best;
             }
-            values.push_back(bestCandidate);
+        );
+
+        // ties go to the lowest candidate index, same as the serial loop
+        ScoredCandidate best = { 0.0f, -1.0f };
+        for (const ScoredCandidate& chunk : chunkBest)
+        {
+            if (chunk.score > best.score)
+                best = chunk;
         }
-        else
-            values.push_back(0.0f);
+        return best.candidate;
+    }
 
-        std::vector<RGB> circleImageLeft(c_circleImageSize * c_circleImageSize, RGB{ 255,255,255 });
-        std::vector<RGB> circleImageRight(c_circleImageSize * c_circleImageSize, RGB{ 255,255,255 });
-        std::vector<RGB> numberlineImageLeft(c_numberlineImageWidth * c_numberlineImageHeight, RGB{ 255, 255, 255 });
-        std::vector<RGB> numberlineImageRight(c_numberlineImageWidth * c_numberlineImageHeight, RGB{ 255, 255, 255 });
+    int BucketIndex(float value) const
+    {
+        int bucketCount = (int)bucketHeads.size();
+        return std::min(std::max(int(value * float(bucketCount)), 0), bucketCount - 1);
+    }
+
+    void Insert(float value)
+    {
+        values.push_back(value);
+        bucketNext.push_back(-1);
 
-        DrawCircle(circleImageLeft, c_circleImageSize, c_circleImageSize, 128, 128, c_circleRadius, RGB{ 0,0,0 });
-        DrawCircle(circleImageRight, c_circleImageSize, c_circleImageSize, 128, 128, c_circleRadius, RGB{ 0,0,0 });
+        // keep about one value per bucket. the bucket count is a power of two so wrapping is a mask.
+        if (values.size() > bucketHeads.size())
+        {
+            RebuildBuckets((int)bucketHeads.size() * 2);
+            return;
+        }
 
-        DrawLine(numberlineImageLeft, c_numberlineImageWidth, c_numberlineImageHeight, c_numberlineStartX, c_numberlineImageHeight / 2, c_numberlineEndX, c_numberlineImageHeight / 2, RGB{ 0, 0, 0 });
-        DrawLine(numberlineImageRight, c_numberlineImageWidth, c_numberlineImageHeight, c_numberlineStartX, c_numberlineImageHeight / 2, c_numberlineEndX, c_numberlineImageHeight / 2, RGB{ 0, 0, 0 });
+        int index = (int)values.size() - 1;
+        int bucket = BucketIndex(value);
+        bucketNext[index] = bucketHeads[bucket];
+        bucketHeads[bucket] = index;
+    }
 
-        for (int sample = 0; sample <= frame; ++sample)
+    void RebuildBuckets(int bucketCount)
+    {
+        bucketHeads.assign(bucketCount, -1);
+        for (int index = 0; index < (int)values.size(); ++index)
         {
-            float value = values[sample];
+            int bucket = BucketIndex(values[index]);
+            bucketNext[index] = bucketHeads[bucket];
+            bucketHeads[bucket] = index;
+        }
+    }
+
+    unsigned int seed;
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> dist;
+    float candidateMultiplier;
+    int maxCandidates;
+
+    ThreadPool* threadPool;
+    std::vector<ScoredCandidate> chunkBest;
 
-            float angle = value * (float)c_pi * 2.0f;
+    // bucketHeads[bucket] is the index of the first value in the bucket, bucketNext[index] is the next value
+    // in the same bucket as values[index]. -1 terminates the list.
+    std::vector<int> bucketHeads;
+    std::vector<int> bucketNext;
+};
+
+static const int c_numFrames = 16;
 
-            int targetX = int(cos(angle) * float(c_circleRadius)) + 128;
-            int targetY = int(sin(angle) * float(c_circleRadius)) + 128;
+static const int c_circleImageSize = 256;
+static const int c_circleRadius = 120;
 
-            unsigned char percentColor = (unsigned char)(255.0f - 255.0f * float(sample) / float(c_numFrames - 1));
+static const int c_numberlineImageWidth = c_circleImageSize;
+static const int c_numberlineImageHeight = c_numberlineImageWidth / 4;
+static const int c_numberlineStartX = c_numberlineImageWidth / 10;
+static const int c_numberlineSizeX = c_numberlineImageWidth * 8 / 10;
+static const int c_numberlineEndX = c_numberlineStartX + c_numberlineSizeX;
+static const int c_numberlineLineStartY = (c_numberlineImageHeight / 2) - 10;
+static const int c_numberlineLineEndY = (c_numberlineImageHeight / 2) + 10;
+
+// the four images that make up a frame of the numberline and circle tests, as parts of the frame's image
+struct NumberlineAndCircleImages
+{
+    ImageView circleLeft;
+    ImageView circleRight;
+    ImageView numberlineLeft;
+    ImageView numberlineRight;
+};
 
-            RGB sampleColor = (sample == frame) ? RGB{ 255, 0, 0 } : RGB{ 192, percentColor, 0 };
+// Renders the frames of the numberline and circle tests. Frame k shows samples 0 to k, with sample k in red and
+// the older ones going from yellow to red as they get newer. The left side shows every sample, and the right side
+// only the second half of them, each as a spoke on a circle and a tick on a numberline.
+// Only the newest sample of a frame is red, and every other sample's color depends only on the sample, so the
+// renderer keeps an image of the samples that are done changing. Each frame is a copy of that with one red sample
+// drawn on top, and then that sample is added to it in its final color. Drawing the samples in the same order
+// as drawing each frame from scratch would gives the exact same pixels, but a whole animation is linear in
+// the number of samples instead of quadratic.
+// In IndexBuffer mode, the coverage of every sample is recorded once instead, and each frame is made by blending
+// that frame's sample colors into the background, without rasterizing any lines.
+struct NumberlineAndCircleRenderer
+{
+    static const int c_outImageW = c_circleImageSize * 2;
+    static const int c_outImageH = c_circleImageSize + c_numberlineImageHeight;
 
-            DrawLine(circleImageLeft, c_circleImageSize, c_circleImageSize, 128, 128, targetX, targetY, sampleColor);
+    enum class Mode
+    {
+        Incremental,
+        IndexBuffer
+    };
 
-            if (sample >= c_numFrames / 2)
-                DrawLine(circleImageRight, c_circleImageSize, c_circleImageSize, 128, 128, targetX, targetY, sampleColor);
+    // frames are rendered in the given pixel layout, see PixelLayout
+    NumberlineAndCircleRenderer(Mode mode = Mode::Incremental, PixelLayout layout = PixelLayout::RGB)
+    {
+        Reset(mode, layout);
+    }
 
-            targetX = int(value * float(c_numberlineSizeX)) + c_numberlineStartX;
-            DrawLine(numberlineImageLeft, c_numberlineImageWidth, c_numberlineImageHeight, targetX, c_numberlineLineStartY, targetX, c_numberlineLineEndY, sampleColor);
+    // Starts over for a new animation, keeping the memory of the last one, so a renderer that is reused for
+    // animation after animation stops allocating once its buffers have grown to fit.
+    void Reset(Mode newMode, PixelLayout layout)
+    {
+        mode = newMode;
 
-            if (sample >= c_numFrames / 2)
-                DrawLine(numberlineImageRight, c_numberlineImageWidth, c_numberlineImageHeight, targetX, c_numberlineLineStartY, targetX, c_numberlineLineEndY, sampleColor);
+        // the circles and numberlines never change, so they are drawn once
+        if (background.PixelCount() == 0 || background.layout != layout)
+        {
+            background.Resize(c_outImageW, c_outImageH, layout, RGB{ 255, 255, 255 });
+            NumberlineAndCircleImages images = SubImages(background);
+            DrawCircle(images.circleLeft, 128, 128, c_circleRadius, RGB{ 0,0,0 });
+            DrawCircle(images.circleRight, 128, 128, c_circleRadius, RGB{ 0,0,0 });
+            DrawLine(images.numberlineLeft, c_numberlineStartX, c_numberlineImageHeight / 2, c_numberlineEndX, c_numberlineImageHeight / 2, RGB{ 0, 0, 0 });
+            DrawLine(images.numberlineRight, c_numberlineStartX, c_numberlineImageHeight / 2, c_numberlineEndX, c_numberlineImageHeight / 2, RGB{ 0, 0, 0 });
         }
 
-        int outImageW = c_circleImageSize * 2;
-        int outImageH = c_circleImageSize + c_numberlineImageHeight;
-        std::vector<RGB> outputImage(outImageW * outImageH);
+        committed = background;
+        committedSamples = 0;
+        coverageValues.clear();
+    }
 
-        RGB* dest = outputImage.data();
-        const RGB* srcLeft = circleImageLeft.data();
-        const RGB* srcRight = circleImageRight.data();
-        for (int i = 0; i < c_circleImageSize; ++i)
+    // renders the frame showing values[0] to values[frame] into outputImage, which becomes c_outImageW x c_outImageH
+    // in the renderer's layout. Rendering the frames in order is cheapest, other orders work but redraw the samples
+    // from the start.
+    void RenderFrame(const std::vector<float>& values, int frame, Image& outputImage)
+    {
+        if (mode == Mode::IndexBuffer)
         {
-            memcpy(dest, srcLeft, c_circleImageSize * 3);
-            dest += c_circleImageSize;
-            srcLeft += c_circleImageSize;
-            memcpy(dest, srcRight, c_circleImageSize * 3);
-            dest += c_circleImageSize;
-            srcRight += c_circleImageSize;
+            if (coverageValues != values)
+                BuildCoverage(values);
+            RenderFrameFromCoverage(frame, palette, outputImage);
+            return;
         }
 
-        srcLeft = numberlineImageLeft.data();
-        srcRight = numberlineImageRight.data();
-        for (int i = 0; i < c_numberlineImageHeight; ++i)
+        if (committedSamples > frame)
+        {
+            committed = background;
+            committedSamples = 0;
+        }
+        while (committedSamples < frame)
         {
-            memcpy(dest, srcLeft, c_circleImageSize * 3);
-            dest += c_circleImageSize;
-            srcLeft += c_circleImageSize;
-            memcpy(dest, srcRight, c_circleImageSize * 3);
-            dest += c_circleImageSize;
-            srcRight += c_circleImageSize;
+            DrawSample(SubImages(committed), values[committedSamples], committedSamples, FinalSampleColor(committedSamples));
+            committedSamples++;
         }
 
-        sprintf_s(fileName, "out/%s_%i.png", baseFileName, frame);
-        stbi_write_png(fileName, outImageW, outImageH, 3, outputImage.data(), outImageW * 3);
+        // copying into the same buffer every frame reuses its memory
+        outputImage = committed;
+        DrawSample(SubImages(outputImage), values[frame], frame, RGB{ 255, 0, 0 });
     }
-}
 
-void NumberlineAndCircleTest(const char* baseFileName, float irrational)
-{
-    static const int c_numFrames = 16;
+    // the two circles side by side, over the two numberlines, in a c_outImageW x c_outImageH image
+    static NumberlineAndCircleImages SubImages(Image& image)
+    {
+        ImageView view = image.View();
+        NumberlineAndCircleImages images;
+        images.circleLeft = view.SubImage(0, 0, c_circleImageSize, c_circleImageSize);
+        images.circleRight = view.SubImage(c_circleImageSize, 0, c_circleImageSize, c_circleImageSize);
+        images.numberlineLeft = view.SubImage(0, c_circleImageSize, c_numberlineImageWidth, c_numberlineImageHeight);
+        images.numberlineRight = view.SubImage(c_circleImageSize, c_circleImageSize, c_numberlineImageWidth, c_numberlineImageHeight);
+        return images;
+    }
 
-    static const int c_circleImageSize = 256;
-    static const int c_circleRadius = 120;
+    // Records the coverage of every sample of values, for RenderFrameFromCoverage. The coverage is recorded in
+    // output image coordinates, so frames resolve straight into the output image.
+    void BuildCoverage(const std::vector<float>& values)
+    {
+        // the coverage buffer has 16 bit sample indices
+        assert(values.size() <= size_t(SampleCoverageBuffer::c_noSample));
+
+        entries.clear();
+        for (int sample = 0; sample < int(values.size()); ++sample)
+            RecordSample(entries, values[sample], sample);
+        coverage.Build(entries, c_outImageW * c_outImageH);
+        coverageValues = values;
+    }
 
-    static const int c_numberlineImageWidth = c_circleImageSize;
-    static const int c_numberlineImageHeight = c_numberlineImageWidth/4;
-    static const int c_numberlineStartX = c_numberlineImageWidth / 10;
-    static const int c_numberlineSizeX = c_numberlineImageWidth * 8 / 10;
-    static const int c_numberlineEndX = c_numberlineStartX + c_numberlineSizeX;
-    static const int c_numberlineLineStartY = (c_numberlineImageHeight / 2) - 10;
-    static const int c_numberlineLineEndY = (c_numberlineImageHeight / 2) + 10;
+    // Renders a frame of the values given to BuildCoverage. This doesn't change the renderer, so any number of
+    // threads can render frames at once, each with their own palette and output image.
+    void RenderFrameFromCoverage(int frame, SampleCoverageBuffer::Palette& palette, Image& outputImage) const
+    {
+        palette.Resize(coverageValues.size());
+        for (int sample = 0; sample < int(coverageValues.size()); ++sample)
+            palette.SetColor(sample, (sample == frame) ? RGB{ 255, 0, 0 } : FinalSampleColor(sample));
 
-    char fileName[256];
-    for (int frame = 0; frame < c_numFrames; ++frame)
+        outputImage = background;
+        coverage.Resolve(outputImage, palette, frame);
+    }
+
+    // the same lines DrawSample draws, recorded in output image coordinates
+    static void RecordSample(std::vector<SampleCoverageBuffer::Entry>& entries, float value, int sample)
     {
-        std::vector<RGB> circleImageLeft(c_circleImageSize*c_circleImageSize, RGB{ 255,255,255 });
-        std::vector<RGB> circleImageRight(c_circleImageSize*c_circleImageSize, RGB{ 255,255,255 });
-        std::vector<RGB> numberlineImageLeft(c_numberlineImageWidth*c_numberlineImageHeight, RGB{ 255, 255, 255 });
-        std::vector<RGB> numberlineImageRight(c_numberlineImageWidth*c_numberlineImageHeight, RGB{ 255, 255, 255 });
+        static const int c_circleRightOffset = c_circleImageSize;
+        static const int c_numberlineLeftOffset = c_circleImageSize * c_outImageW;
+        static const int c_numberlineRightOffset = c_numberlineLeftOffset + c_circleImageSize;
 
-        DrawCircle(circleImageLeft, c_circleImageSize, c_circleImageSize, 128, 128, c_circleRadius, RGB{ 0,0,0 });
-        DrawCircle(circleImageRight, c_circleImageSize, c_circleImageSize, 128, 128, c_circleRadius, RGB{ 0,0,0 });
+        float angle = value * (float)c_pi * 2.0f;
 
-        DrawLine(numberlineImageLeft, c_numberlineImageWidth, c_numberlineImageHeight, c_numberlineStartX, c_numberlineImageHeight / 2, c_numberlineEndX, c_numberlineImageHeight / 2, RGB{0, 0, 0});
-        DrawLine(numberlineImageRight, c_numberlineImageWidth, c_numberlineImageHeight, c_numberlineStartX, c_numberlineImageHeight / 2, c_numberlineEndX, c_numberlineImageHeight / 2, RGB{ 0, 0, 0 });
+        int targetX = int(cos(angle) * float(c_circleRadius)) + 128;
+        int targetY = int(sin(angle) * float(c_circleRadius)) + 128;
 
-        float value = 0.0f;
-        for (int sample = 0; sample <= frame; ++sample)
-        {
-            float angle = value * (float)c_pi * 2.0f;
+        SampleCoverageBuffer::RecordLine(entries, c_circleImageSize, c_circleImageSize, c_outImageW, 0, 128, 128, targetX, targetY, sample);
+
+        if (sample >= c_numFrames / 2)
+            SampleCoverageBuffer::RecordLine(entries, c_circleImageSize, c_circleImageSize, c_outImageW, c_circleRightOffset, 128, 128, targetX, targetY, sample);
 
-            int targetX = int(cos(angle) * float(c_circleRadius)) + 128;
-            int targetY = int(sin(angle) * float(c_circleRadius)) + 128;
+        targetX = int(value * float(c_numberlineSizeX)) + c_numberlineStartX;
+        SampleCoverageBuffer::RecordLine(entries, c_numberlineImageWidth, c_numberlineImageHeight, c_outImageW, c_numberlineLeftOffset, targetX, c_numberlineLineStartY, targetX, c_numberlineLineEndY, sample);
+
+        if (sample >= c_numFrames / 2)
+            SampleCoverageBuffer::RecordLine(entries, c_numberlineImageWidth, c_numberlineImageHeight, c_outImageW, c_numberlineRightOffset, targetX, c_numberlineLineStartY, targetX, c_numberlineLineEndY, sample);
+    }
+
+    // pixels [x0, x1) by [y0, y1) of the output image
+    struct Rect
+    {
+        int x0, y0, x1, y1;
+    };
 
-            unsigned char percentColor = (unsigned char)(255.0f - 255.0f * float(sample) / float(c_numFrames-1));
+    // The part of the output image that can change from frame - 1 to frame. Every sample keeps its color from one
+    // frame to the next except sample frame - 1, which goes from red to its final color, and sample frame, which
+    // is new, so the pixels those two can draw to hold all of the changes.
+    static Rect ChangedRect(const std::vector<float>& values, int frame)
+    {
+        if (frame == 0)
+            return Rect{ 0, 0, c_outImageW, c_outImageH };
 
-            RGB sampleColor = (sample == frame) ? RGB{ 255, 0, 0 } : RGB{ 192, percentColor, 0 };
+        Rect rect = { c_outImageW, c_outImageH, 0, 0 };
+        AddSampleToRect(rect, values[frame - 1], frame - 1);
+        AddSampleToRect(rect, values[frame], frame);
+        return rect;
+    }
 
-            DrawLine(circleImageLeft, c_circleImageSize, c_circleImageSize, 128, 128, targetX, targetY, sampleColor);
+    // grows rect to hold the pixels of the same lines DrawSample draws, in output image coordinates
+    static void AddSampleToRect(Rect& rect, float value, int sample)
+    {
+        float angle = value * (float)c_pi * 2.0f;
 
-            if (sample >= c_numFrames / 2)
-                DrawLine(circleImageRight, c_circleImageSize, c_circleImageSize, 128, 128, targetX, targetY, sampleColor);
+        int targetX = int(cos(angle) * float(c_circleRadius)) + 128;
+        int targetY = int(sin(angle) * float(c_circleRadius)) + 128;
 
-            targetX = int(value * float(c_numberlineSizeX)) + c_numberlineStartX;
-            DrawLine(numberlineImageLeft, c_numberlineImageWidth, c_numberlineImageHeight, targetX, c_numberlineLineStartY, targetX, c_numberlineLineEndY, sampleColor);
+        AddLineToRect(rect, c_circleImageSize, c_circleImageSize, 0, 0, 128, 128, targetX, targetY);
 
-            if (sample >= c_numFrames / 2)
-                DrawLine(numberlineImageRight, c_numberlineImageWidth, c_numberlineImageHeight, targetX, c_numberlineLineStartY, targetX, c_numberlineLineEndY, sampleColor);
+        if (sample >= c_numFrames / 2)
+            AddLineToRect(rect, c_circleImageSize, c_circleImageSize, c_circleImageSize, 0, 128, 128, targetX, targetY);
 
-            value = Fract(value + irrational);
-        }
+        targetX = int(value * float(c_numberlineSizeX)) + c_numberlineStartX;
+        AddLineToRect(rect, c_numberlineImageWidth, c_numberlineImageHeight, 0, c_circleImageSize, targetX, c_numberlineLineStartY, targetX, c_numberlineLineEndY);
 
-        int outImageW = c_circleImageSize * 2;
-        int outImageH = c_circleImageSize + c_numberlineImageHeight;
-        std::vector<RGB> outputImage(outImageW*outImageH);
+        if (sample >= c_numFrames / 2)
+            AddLineToRect(rect, c_numberlineImageWidth, c_numberlineImageHeight, c_circleImageSize, c_circleImageSize, targetX, c_numberlineLineStartY, targetX, c_numberlineLineEndY);
+    }
 
-        RGB* dest = outputImage.data();
-        const RGB* srcLeft = circleImageLeft.data();
-        const RGB* srcRight = circleImageRight.data();
-        for (int i = 0; i < c_circleImageSize; ++i)
-        {
-            memcpy(dest, srcLeft, c_circleImageSize * 3);
-            dest += c_circleImageSize;
-            srcLeft += c_circleImageSize;
-            memcpy(dest, srcRight, c_circleImageSize * 3);
-            dest += c_circleImageSize;
-            srcRight += c_circleImageSize;
-        }
+    // grows rect to hold the spans of pixels a line can draw to, for a line in the width x height sub image at
+    // (offsetX, offsetY) of the output image
+    static void AddLineToRect(Rect& rect, int width, int height, int offsetX, int offsetY, int x1, int y1, int x2, int y2)
+    {
+        ForEachLineSpan(width, height, x1, y1, x2, y2,
+            [&](const LineShape&, int iy, int startX, int endX)
+            {
+                rect.x0 = std::min(rect.x0, offsetX + startX);
+                rect.y0 = std::min(rect.y0, offsetY + iy);
+                rect.x1 = std::max(rect.x1, offsetX + endX + 1);
+                rect.y1 = std::max(rect.y1, offsetY + iy + 1);
+            }
+        );
+    }
+
+    // the color of a sample in the frames after its own
+    static RGB FinalSampleColor(int sample)
+    {
+        unsigned char percentColor = (unsigned char)(255.0f - 255.0f * float(sample) / float(c_numFrames - 1));
+        return RGB{ 192, percentColor, 0 };
+    }
+
+    static void DrawSample(const NumberlineAndCircleImages& images, float value, int sample, RGB sampleColor)
+    {
+        float angle = value * (float)c_pi * 2.0f;
+
+        int targetX = int(cos(angle) * float(c_circleRadius)) + 128;
+        int targetY = int(sin(angle) * float(c_circleRadius)) + 128;
+
+        DrawLine(images.circleLeft, 128, 128, targetX, targetY, sampleColor);
+
+        if (sample >= c_numFrames / 2)
+            DrawLine(images.circleRight, 128, 128, targetX, targetY, sampleColor);
+
+        targetX = int(value * float(c_numberlineSizeX)) + c_numberlineStartX;
+        DrawLine(images.numberlineLeft, targetX, c_numberlineLineStartY, targetX, c_numberlineLineEndY, sampleColor);
+
+        if (sample >= c_numFrames / 2)
+            DrawLine(images.numberlineRight, targetX, c_numberlineLineStartY, targetX, c_numberlineLineEndY, sampleColor);
+    }
+
+    // the circles and numberlines without any samples, laid out like the output image
+    Image background;
 
-        srcLeft = numberlineImageLeft.data();
-        srcRight = numberlineImageRight.data();
-        for (int i = 0; i < c_numberlineImageHeight; ++i)
+    // every sample before committedSamples, in their final colors
+    Image committed;
+    int committedSamples = 0;
+
+    Mode mode = Mode::Incremental;
+
+    // for Mode::IndexBuffer
+    SampleCoverageBuffer coverage;
+    std::vector<SampleCoverageBuffer::Entry> entries;
+    std::vector<float> coverageValues;
+    SampleCoverageBuffer::Palette palette;
+};
+
+// Frames are drawn in this layout, and turned into packed RGB for the encoder once they are done. With a plane per
+// channel, blending loads 8 values of a channel straight into a register, instead of shuffling them out of RGB.
+static const PixelLayout c_frameLayout = PixelLayout::Planar;
+
+// The renderer and the buffers an animation is rendered into, kept from one animation to the next. Once they have
+// grown to fit, rendering frames doesn't allocate, and neither does encoding them, since stb_image_write allocates
+// from g_pngBufferPool.
+struct FrameArena
+{
+    NumberlineAndCircleRenderer renderer;
+    std::vector<Image> images;
+    std::vector<std::vector<RGB>> frames;
+    std::vector<SampleCoverageBuffer::Palette> palettes;
+    std::vector<stbi_write_apng_frame> animationFrames;
+};
+
+// Writes the frames of the values as the animated PNG out/<baseFileName>.png, showing each frame for half a second
+// and looping forever. With a thread pool, frames are rendered from the sample coverage, which lets them be made in
+// any order, and they are rendered and encoded on all threads at once. Without one, they are rendered incrementally
+// in order.
+void WriteNumberlineAndCircleFrames(const char* baseFileName, const std::vector<float>& values, FrameArena& arena, ThreadPool* threadPool = nullptr)
+{
+    // the encoder settings are read once here, and each encode is handed them instead of reading the globals
+    stbi_write_png_options pngOptions;
+    stbi_write_png_default_options(&pngOptions);
+
+    std::vector<Image>& images = arena.images;
+    std::vector<std::vector<RGB>>& frames = arena.frames;
+    images.resize(c_numFrames);
+    frames.resize(c_numFrames);
+
+    if (!threadPool || threadPool->ThreadCount() == 1)
+    {
+        NumberlineAndCircleRenderer& renderer = arena.renderer;
+        renderer.Reset(NumberlineAndCircleRenderer::Mode::Incremental, c_frameLayout);
+
+        for (int frame = 0; frame < c_numFrames; ++frame)
         {
-            memcpy(dest, srcLeft, c_circleImageSize * 3);
-            dest += c_circleImageSize;
-            srcLeft += c_circleImageSize;
-            memcpy(dest, srcRight, c_circleImageSize * 3);
-            dest += c_circleImageSize;
-            srcRight += c_circleImageSize;
+            renderer.RenderFrame(values, frame, images[frame]);
+            images[frame].ToRGB(frames[frame]);
         }
+    }
+    else
+    {
+        NumberlineAndCircleRenderer& renderer = arena.renderer;
+        renderer.Reset(NumberlineAndCircleRenderer::Mode::IndexBuffer, c_frameLayout);
+        renderer.BuildCoverage(values);
+
+        arena.palettes.resize(c_numFrames);
+        threadPool->ParallelFor(c_numFrames,
+            [&](int frame)
+            {
+                renderer.RenderFrameFromCoverage(frame, arena.palettes[frame], images[frame]);
+                images[frame].ToRGB(frames[frame]);
+            }
+        );
+    }
+
+    // stb_image_write encodes the frames of the animation in parallel through the pool, see PNGParallelFor.
+    // Each frame only stores the part that can have changed since the frame before, which the renderer knows from
+    // the samples without comparing any pixels.
+    std::vector<stbi_write_apng_frame>& animationFrames = arena.animationFrames;
+    animationFrames.resize(c_numFrames);
+    for (int frame = 0; frame < c_numFrames; ++frame)
+    {
+        NumberlineAndCircleRenderer::Rect rect = NumberlineAndCircleRenderer::ChangedRect(values, frame);
+        animationFrames[frame] = stbi_write_apng_frame{ frames[frame].data(), 1, 2, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0 };
+    }
+
+    char fileName[256];
+    sprintf_s(fileName, "out/%s.png", baseFileName);
+    stbi_write_apng(fileName, NumberlineAndCircleRenderer::c_outImageW, NumberlineAndCircleRenderer::c_outImageH, 3, animationFrames.data(), c_numFrames, NumberlineAndCircleRenderer::c_outImageW * 3, &pngOptions);
+}
+
+void NumberlineAndCircleTestBN(const char* baseFileName, FrameArena& arena, ThreadPool* threadPool = nullptr)
+{
+    BlueNoiseSequence1D blueNoise(0x1337beef);
+    for (int frame = 0; frame < c_numFrames; ++frame)
+        blueNoise.AddValue();
+
+    WriteNumberlineAndCircleFrames(baseFileName, blueNoise.values, arena, threadPool);
+}
 
-        sprintf_s(fileName, "out/%s_%i.png", baseFileName, frame);
-        stbi_write_png(fileName, outImageW, outImageH, 3, outputImage.data(), outImageW * 3);
+void NumberlineAndCircleTest(const char* baseFileName, float irrational, FrameArena& arena, ThreadPool* threadPool = nullptr)
+{
+    std::vector<float> values(c_numFrames);
+    float value = 0.0f;
+    for (float& sampleValue : values)
+    {
+        sampleValue = value;
+        value = Fract(value + irrational);
     }
+
+    WriteNumberlineAndCircleFrames(baseFileName, values, arena, threadPool);
 }
 
 int main(int argc, char** argv)
 {
-    NumberlineAndCircleTestBN("blue");
-    NumberlineAndCircleTest("golden", (float)c_goldenRatioConjugate);
-    NumberlineAndCircleTest("pi", (float)c_pi);
-    NumberlineAndCircleTest("sqrt2", sqrt(2.0f));
+    ThreadPool threadPool;
+    g_pngThreadPool = &threadPool;
+    FrameArena frameArena;
+    NumberlineAndCircleTestBN("blue", frameArena, &threadPool);
+    NumberlineAndCircleTest("golden", (float)c_goldenRatioConjugate, frameArena, &threadPool);
+    NumberlineAndCircleTest("pi", (float)c_pi, frameArena, &threadPool);
+    NumberlineAndCircleTest("sqrt2", sqrt(2.0f), frameArena, &threadPool);
+
+    // show the evolution of evaluating a continued fraction
+    PrintContinuedFractionEvaluation(c_pi, "pi");
+    PrintContinuedFractionEvaluation(c_goldenRatio, "golden ratio");
+    PrintContinuedFractionEvaluation(c_goldenRatioConjugate, "golden ratio conjugate");
 
     return 0;
 
@@ -498,51 +2225,47 @@ int main(int argc, char** argv)
         PrintContinuedFraction(sqrt(5.0), "sqrt(5)");
 
         PrintContinuedFraction(sqrt(7.0), "sqrt(7)");
-    }
 
-    // show the evolution of evaluating a continued fraction - pi
-    {
-        printf("\n\nShowing evaluation of continued fraction of pi (%f)...\n", c_pi);
-        std::vector<int> CF = ToContinuedFraction(c_pi);
+        printf("\nExact Continued Fractions...\n");
 
-        for (size_t i = 1; i < CF.size(); ++i)
-        {
-            size_t n, d;
-            ToFraction(CF, (int)i, n, d);
-            double value = FromContinuedFraction(CF, (int)i);
-            double relativeError = abs(value / c_pi - 1.0);
-            printf("[%i] %f aka %zu/%zu (%f)\n", CF[i-1], value, n, d, relativeError);
-        }
-    }
+        PrintContinuedFraction(PiExpansion(), "Pi", 40);
 
-    // show the evolution of evaluating a continued fraction - golden ratio
-    {
-        printf("\n\nShowing evaluation of continued fraction of golden ratio (%f)...\n", c_goldenRatio);
-        std::vector<int> CF = ToContinuedFraction(c_goldenRatio);
+        PrintContinuedFraction(QuadraticSurdExpansion(1, 5, 2), "Golden Ratio", 40);
 
-        for (size_t i = 1; i < CF.size(); ++i)
-        {
-            size_t n, d;
-            ToFraction(CF, (int)i, n, d);
-            double value = FromContinuedFraction(CF, (int)i);
-            double relativeError = abs(value / c_goldenRatio - 1.0);
-            printf("[%i] %f aka %zu/%zu (%f)\n", CF[i - 1], value, n, d, relativeError);
-        }
+        PrintContinuedFraction(EExpansion(), "e", 40);
+
+        PrintContinuedFraction(QuadraticSurdExpansion(0, 2, 1), "sqrt(2)", 40);
+
+        PrintContinuedFraction(QuadraticSurdExpansion(0, 7, 1), "sqrt(7)", 40);
+
+        PrintContinuedFraction(RationalExpansion::FromDouble(c_pi), "double(Pi)", 40);
+
+        printf("\nPeriodic Continued Fractions...\n");
+
+        PeriodicContinuedFraction periodic;
+        QuadraticSurdContinuedFraction(1, 5, 2, periodic);
+        PrintContinuedFraction(periodic, "Golden Ratio");
+
+        QuadraticSurdContinuedFraction(-1, 5, 2, periodic);
+        PrintContinuedFraction(periodic, "Golden Ratio Conjugate");
+
+        SqrtContinuedFraction(2, periodic);
+        PrintContinuedFraction(periodic, "sqrt(2)");
+
+        SqrtContinuedFraction(3, periodic);
+        PrintContinuedFraction(periodic, "sqrt(3)");
+
+        SqrtContinuedFraction(5, periodic);
+        PrintContinuedFraction(periodic, "sqrt(5)");
+
+        SqrtContinuedFraction(7, periodic);
+        PrintContinuedFraction(periodic, "sqrt(7)");
     }
 
-    // show the evolution of evaluating a continued fraction - golden ratio conjugate
+    // show the convergents of long exact expansions
     {
-        printf("\n\nShowing evaluation of continued fraction of golden ratio conjugate (%f)...\n", c_goldenRatioConjugate);
-        std::vector<int> CF = ToContinuedFraction(c_goldenRatioConjugate);
-
-        for (size_t i = 1; i < CF.size(); ++i)
-        {
-            size_t n, d;
-            ToFraction(CF, (int)i, n, d);
-            double value = FromContinuedFraction(CF, (int)i);
-            double relativeError = abs(value / c_goldenRatioConjugate - 1.0);
-            printf("[%i] %f aka %zu/%zu (%f)\n", CF[i - 1], value, n, d, relativeError);
-        }
+        PrintConvergents(PiExpansion(), "pi", 60);
+        PrintConvergents(EExpansion(), "e", 60);
     }
 
     // show some numbers made from continued fractions
@@ -586,6 +2309,25 @@ int main(int argc, char** argv)
         );
     }
 
+    // the error of the first 20 terms of sqrt(n) for n < 10 million, and of made up periodic continued fractions
+    {
+        SweepContinuedFractionError("out/sqrtsweep.bin", SqrtCatalogue(2, 10000000), 20, threadPool, ResultWriter::Format::Binary);
+
+        SweepContinuedFractionError("out/periodicsweep.csv",
+            PeriodicCatalogue(
+                {
+                    {"A", {{1}, {2, 1}}},
+                    {"B", {{1}, {1, 2, 1}}},
+                    {"C", {{1}, {1, 1, 2, 1}}},
+                    {"[0; (1, 2, 3)]", {{0}, {1, 2, 3}}},
+                    {"[0; (1, 1, 1, 1, 50)]", {{0}, {1, 1, 1, 1, 50}}},
+                }
+            ),
+            20,
+            threadPool
+        );
+    }
+
     system("pause");
     return 0;
 }
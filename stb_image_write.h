@@ -36,6 +36,14 @@ BUILDING:
    unsigned char * my_compress(unsigned char *data, int data_len, int *out_len, int quality);
    The returned data will be freed with STBIW_FREE() (free() by default),
    so it must be heap allocated with STBIW_MALLOC() (malloc() by default),
+   You can #define STBIW_NO_SIMD to filter PNG rows without SSE2 on x86.
+   You can #define STBIW_PARALLEL_FOR(count,func,context) to spread PNG encoding
+   across threads. It must call func(context,i) for every i in [0,count) and
+   return once all of the calls have finished; the calls can run in any order
+   and at the same time. PNG rows are then filtered and compressed in bands of
+   about STBIW_PNG_BAND_BYTES (256K unless you #define it), each band as its
+   own DEFLATE blocks ending on a byte boundary, which are joined into one
+   standard zlib stream. The files are slightly larger than single band ones.
 
 UNICODE:
 
@@ -71,9 +79,33 @@ USAGE:
 
    You can configure it with these global variables:
       int stbi_write_tga_with_rle;             // defaults to true; set to 0 to disable RLE
-      int stbi_write_png_compression_level;    // defaults to 8; set to higher for more compression
+      int stbi_write_png_compression_level;    // defaults to 8; 1 is fastest, 9 is smallest
       int stbi_write_force_png_filter;         // defaults to -1; set to 0..5 to force a filter mode
 
+   PNG can also be configured per call, which is safe when several threads
+   encode at once with different settings, and can use its own allocator:
+
+     void stbi_write_png_default_options(stbi_write_png_options *options); // fills in the globals' values
+     unsigned char *stbi_write_png_to_mem_ex(const unsigned char *pixels, int stride_in_bytes, int w, int h, int comp, int *out_len, const stbi_write_png_options *options);
+     int stbi_write_png_to_func_ex(stbi_write_func *func, void *context, int w, int h, int comp, const void *data, int stride_in_bytes, const stbi_write_png_options *options);
+     int stbi_write_png_ex(char const *filename, int w, int h, int comp, const void *data, int stride_in_bytes, const stbi_write_png_options *options);
+
+   The PNG returned by stbi_write_png_to_mem_ex is allocated with the options'
+   allocator.
+
+   Animated PNGs (APNG) are written from a list of whole frames:
+
+     int stbi_write_apng(char const *filename, int w, int h, int comp, const stbi_write_apng_frame *frames, int frame_count, int stride_in_bytes, const stbi_write_png_options *options);
+     int stbi_write_apng_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const stbi_write_apng_frame *frames, int frame_count, int stride_in_bytes, const stbi_write_png_options *options);
+     unsigned char *stbi_write_apng_to_mem(const stbi_write_apng_frame *frames, int frame_count, int stride_in_bytes, int w, int h, int comp, int *out_len, const stbi_write_png_options *options);
+
+   Each frame after the first only stores the rectangle of pixels that
+   differ from the frame before it. A caller that knows what changed can
+   give that rectangle in the frame's x, y, w and h instead of having the
+   frames compared; otherwise w is 0. The frames are encoded in separate
+   STBIW_PARALLEL_FOR jobs, and the animation loops forever. Viewers
+   without APNG support show the first frame.
+
 
    You can define STBI_WRITE_NO_STDIO to disable the file variant of these
    functions, so the library will not use stdio.h at all. However, this will
@@ -102,7 +134,9 @@ USAGE:
    at the end of the line.)
 
    PNG allows you to set the deflate compression level by setting the global
-   variable 'stbi_write_png_compression_level' (it defaults to 8).
+   variable 'stbi_write_png_compression_level' (it defaults to 8). Levels go
+   from 1 to 9 and trade speed for size like zlib's levels do; each block of
+   output uses whichever of stored, fixed or dynamic huffman coding is smallest.
 
    HDR expects linear float data. Since the format is always 32-bit rgb(e)
    data, alpha (if provided) is discarded, and for monochrome data it is
@@ -198,6 +232,40 @@ STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x,
 
 STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
+// settings for one PNG encode, so encodes on different threads can use different settings
+typedef struct
+{
+   int compression_level;  // 1 (fastest) to 9 (smallest)
+   int force_filter;       // -1 picks a filter for each row, 0..4 uses that filter for every row
+   int flip_vertically;    // non-zero writes the rows bottom to top
+   // allocator for the scratch memory and the returned PNG. if alloc_func is NULL, STBIW_MALLOC() and STBIW_FREE() are used.
+   // alloc_func and free_func have to be set together
+   void *(*alloc_func)(void *user, size_t size);
+   void (*free_func)(void *user, void *ptr);
+   void *alloc_user;
+} stbi_write_png_options;
+
+STBIWDEF void stbi_write_png_default_options(stbi_write_png_options *options);
+STBIWDEF unsigned char *stbi_write_png_to_mem_ex(const unsigned char *pixels, int stride_in_bytes, int w, int h, int comp, int *out_len, const stbi_write_png_options *options);
+STBIWDEF int stbi_write_png_to_func_ex(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data, int stride_in_bytes, const stbi_write_png_options *options);
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_png_ex(char const *filename, int w, int h, int comp, const void  *data, int stride_in_bytes, const stbi_write_png_options *options);
+#endif
+
+// one frame of an animated PNG
+typedef struct
+{
+   const void *pixels;        // the whole w x h image
+   int delay_num, delay_den;  // how long the frame shows, as a fraction of a second
+   int x, y, w, h;            // holds every pixel that differs from the frame before. if w is 0, the frames are compared to find it
+} stbi_write_apng_frame;
+
+STBIWDEF unsigned char *stbi_write_apng_to_mem(const stbi_write_apng_frame *frames, int frame_count, int stride_in_bytes, int w, int h, int comp, int *out_len, const stbi_write_png_options *options);
+STBIWDEF int stbi_write_apng_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const stbi_write_apng_frame *frames, int frame_count, int stride_in_bytes, const stbi_write_png_options *options);
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_apng(char const *filename, int w, int h, int comp, const stbi_write_apng_frame *frames, int frame_count, int stride_in_bytes, const stbi_write_png_options *options);
+#endif
+
 #endif//INCLUDE_STB_IMAGE_WRITE_H
 
 #ifdef STB_IMAGE_WRITE_IMPLEMENTATION
@@ -220,6 +288,42 @@ STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 #include <string.h>
 #include <math.h>
 
+#if !defined(STBIW_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define STBIW_SSE2
+#include <emmintrin.h>
+
+// PNG chunk crcs use PCLMULQDQ when the cpu has it. (SSE4.2's crc32 instruction is CRC-32C, not the PNG crc.)
+#if !defined(STBIW_CRC32) && (defined(_MSC_VER) || defined(__GNUC__) || defined(__clang__))
+#define STBIW_PCLMUL
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define STBIW_TARGET_PCLMUL
+static int stbiw__pclmul_detect(void)
+{
+   int info[4];
+   __cpuid(info, 1);
+   return (info[2] & (1 << 1)) != 0;
+}
+#else
+#define STBIW_TARGET_PCLMUL __attribute__((target("pclmul")))
+static int stbiw__pclmul_detect(void)
+{
+   return __builtin_cpu_supports("pclmul");
+}
+#endif
+
+// the cpu is only asked once. Threads that race on the first call all store the same answer.
+static int stbiw__pclmul_available(void)
+{
+   static int available = -1;
+   if (available < 0)
+      available = stbiw__pclmul_detect();
+   return available;
+}
+#endif
+#endif
+
 #if defined(STBIW_MALLOC) && defined(STBIW_FREE) && (defined(STBIW_REALLOC) || defined(STBIW_REALLOC_SIZED))
 // ok
 #elif !defined(STBIW_MALLOC) && !defined(STBIW_FREE) && !defined(STBIW_REALLOC) && !defined(STBIW_REALLOC_SIZED)
@@ -251,6 +355,18 @@ STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
 #define STBIW_UCHAR(x) (unsigned char) ((x) & 0xff)
 
+#ifndef STBIW_PNG_BAND_BYTES
+#ifdef STBIW_PARALLEL_FOR
+#define STBIW_PNG_BAND_BYTES (256*1024)
+#else
+#define STBIW_PNG_BAND_BYTES 0x7fffffff // a single band, same output as before bands existed
+#endif
+#endif
+
+#ifndef STBIW_PARALLEL_FOR
+#define STBIW_PARALLEL_FOR(count,func,context) do { int stbiw__pi; for (stbiw__pi=0; stbiw__pi < (count); ++stbiw__pi) (func)((context),stbiw__pi); } while (0)
+#endif
+
 #ifdef STB_IMAGE_WRITE_STATIC
 static int stbi__flip_vertically_on_write=0;
 static int stbi_write_png_compression_level = 8;
@@ -776,43 +892,21 @@ STBIWDEF int stbi_write_hdr(char const *filename, int x, int y, int comp, const
 // PNG writer
 //
 
-#ifndef STBIW_ZLIB_COMPRESS
-// stretchy buffer; stbiw__sbpush() == vector<>::push_back() -- stbiw__sbcount() == vector<>::size()
-#define stbiw__sbraw(a) ((int *) (a) - 2)
-#define stbiw__sbm(a)   stbiw__sbraw(a)[0]
-#define stbiw__sbn(a)   stbiw__sbraw(a)[1]
-
-#define stbiw__sbneedgrow(a,n)  ((a)==0 || stbiw__sbn(a)+n >= stbiw__sbm(a))
-#define stbiw__sbmaybegrow(a,n) (stbiw__sbneedgrow(a,(n)) ? stbiw__sbgrow(a,n) : 0)
-#define stbiw__sbgrow(a,n)  stbiw__sbgrowf((void **) &(a), (n), sizeof(*(a)))
-
-#define stbiw__sbpush(a, v)      (stbiw__sbmaybegrow(a,1), (a)[stbiw__sbn(a)++] = (v))
-#define stbiw__sbcount(a)        ((a) ? stbiw__sbn(a) : 0)
-#define stbiw__sbfree(a)         ((a) ? STBIW_FREE(stbiw__sbraw(a)),0 : 0)
-
-static void *stbiw__sbgrowf(void **arr, int increment, int itemsize)
+static void *stbiw__png_alloc(const stbi_write_png_options *options, size_t size)
 {
-   int m = *arr ? 2*stbiw__sbm(*arr)+increment : increment+1;
-   void *p = STBIW_REALLOC_SIZED(*arr ? stbiw__sbraw(*arr) : 0, *arr ? (stbiw__sbm(*arr)*itemsize + sizeof(int)*2) : 0, itemsize * m + sizeof(int)*2);
-   STBIW_ASSERT(p);
-   if (p) {
-      if (!*arr) ((int *) p)[1] = 0;
-      *arr = (void *) ((int *) p + 2);
-      stbiw__sbm(*arr) = m;
-   }
-   return *arr;
+   STBIW_ASSERT(!options->alloc_func || options->free_func);
+   return options->alloc_func ? options->alloc_func(options->alloc_user, size) : STBIW_MALLOC(size);
 }
 
-static unsigned char *stbiw__zlib_flushf(unsigned char *data, unsigned int *bitbuffer, int *bitcount)
+static void stbiw__png_free(const stbi_write_png_options *options, void *p)
 {
-   while (*bitcount >= 8) {
-      stbiw__sbpush(data, STBIW_UCHAR(*bitbuffer));
-      *bitbuffer >>= 8;
-      *bitcount -= 8;
-   }
-   return data;
+   if (!options->alloc_func)
+      STBIW_FREE(p);
+   else if (p)
+      options->free_func(options->alloc_user, p);
 }
 
+#ifndef STBIW_ZLIB_COMPRESS
 static int stbiw__zlib_bitrev(int code, int codebits)
 {
    int res=0;
@@ -823,163 +917,579 @@ static int stbiw__zlib_bitrev(int code, int codebits)
    return res;
 }
 
-static unsigned int stbiw__zlib_countm(unsigned char *a, unsigned char *b, int limit)
+#define stbiw__ZHASH_BITS    15
+#define stbiw__ZHASH         (1 << stbiw__ZHASH_BITS)
+#define stbiw__ZWINDOW       32768
+#define stbiw__ZBLOCK_TOKENS 16384 // symbols per block, each block gets its own huffman tables
+
+static const unsigned short stbiw__zlength_base[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
+static const unsigned char  stbiw__zlength_extra[]= { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
+static const unsigned short stbiw__zdist_base[]   = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
+static const unsigned char  stbiw__zdist_extra[]  = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+// per compression level, like zlib's: matches at least good_length long search a quarter of the
+// chain, matches at least lazy_length long skip the lazy search (0 = never search lazily), matches
+// at least nice_length long end the search, and max_chain is the most positions a search looks at.
+typedef struct
 {
-   int i;
-   for (i=0; i < limit && i < 258; ++i)
-      if (a[i] != b[i]) break;
-   return i;
+   unsigned short good_length, lazy_length, nice_length, max_chain;
+} stbiw__zlevel;
+
+static const stbiw__zlevel stbiw__zlevels[10] =
+{
+   {  0,   0,   0,    0 }, // unused, level 0 is treated as 1
+   {  4,   0,   8,    4 },
+   {  4,   0,  16,    8 },
+   {  4,   0,  32,   32 },
+   {  4,   4,  16,   16 },
+   {  8,  16,  32,   32 },
+   {  8,  16, 128,  128 },
+   {  8,  32, 128,  256 },
+   { 32, 128, 258, 1024 },
+   { 32, 258, 258, 4096 },
+};
+
+typedef struct
+{
+   unsigned short litlen;    // literal byte, or 257+length code for a match
+   unsigned short length;    // extra bits value of the length
+   unsigned short dist;      // distance code
+   unsigned short distance;  // extra bits value of the distance
+} stbiw__ztoken;
+
+typedef struct
+{
+   const stbi_write_png_options *options; // allocator
+   unsigned char *out;
+   int out_len, out_cap, failed;
+   unsigned int bitbuf;
+   int bitcount;
+   unsigned char *data;
+   int end, block_start;
+   const stbiw__zlevel *level;
+   int *head;          // newest position for each hash, or -1
+   int *prev;          // previous position with the same hash, indexed by position mod the window
+   stbiw__ztoken *tokens;
+   int token_count;
+} stbiw__zlib;
+
+// makes room for n more bytes of output, or returns 0 once an allocation has failed
+static int stbiw__zlib_grow(stbiw__zlib *z, int n)
+{
+   if (z->failed)
+      return 0;
+   if (z->out_len + n > z->out_cap) {
+      int cap = 2*z->out_cap + n;
+      unsigned char *p = (unsigned char *) stbiw__png_alloc(z->options, cap);
+      if (p == NULL) {
+         z->failed = 1;
+         return 0;
+      }
+      if (z->out) {
+         STBIW_MEMMOVE(p, z->out, z->out_len);
+         stbiw__png_free(z->options, z->out);
+      }
+      z->out = p;
+      z->out_cap = cap;
+   }
+   return 1;
+}
+
+static void stbiw__zlib_bits(stbiw__zlib *z, unsigned int code, int codebits)
+{
+   z->bitbuf |= code << z->bitcount;
+   z->bitcount += codebits;
+   while (z->bitcount >= 8) {
+      if (stbiw__zlib_grow(z, 1))
+         z->out[z->out_len++] = STBIW_UCHAR(z->bitbuf);
+      z->bitbuf >>= 8;
+      z->bitcount -= 8;
+   }
+}
+
+static void stbiw__zlib_align(stbiw__zlib *z)
+{
+   // pad with 0 bits to byte boundary
+   if (z->bitcount)
+      stbiw__zlib_bits(z, 0, 8 - z->bitcount);
 }
 
 static unsigned int stbiw__zhash(unsigned char *data)
 {
-   stbiw_uint32 hash = data[0] + (data[1] << 8) + (data[2] << 16);
-   hash ^= hash << 3;
-   hash += hash >> 5;
-   hash ^= hash << 4;
-   hash += hash >> 17;
-   hash ^= hash << 25;
-   hash += hash >> 6;
-   return hash;
-}
-
-#define stbiw__zlib_flush() (out = stbiw__zlib_flushf(out, &bitbuf, &bitcount))
-#define stbiw__zlib_add(code,codebits) \
-      (bitbuf |= (code) << bitcount, bitcount += (codebits), stbiw__zlib_flush())
-#define stbiw__zlib_huffa(b,c)  stbiw__zlib_add(stbiw__zlib_bitrev(b,c),c)
-// default huffman tables
-#define stbiw__zlib_huff1(n)  stbiw__zlib_huffa(0x30 + (n), 8)
-#define stbiw__zlib_huff2(n)  stbiw__zlib_huffa(0x190 + (n)-144, 9)
-#define stbiw__zlib_huff3(n)  stbiw__zlib_huffa(0 + (n)-256,7)
-#define stbiw__zlib_huff4(n)  stbiw__zlib_huffa(0xc0 + (n)-280,8)
-#define stbiw__zlib_huff(n)  ((n) <= 143 ? stbiw__zlib_huff1(n) : (n) <= 255 ? stbiw__zlib_huff2(n) : (n) <= 279 ? stbiw__zlib_huff3(n) : stbiw__zlib_huff4(n))
-#define stbiw__zlib_huffb(n) ((n) <= 143 ? stbiw__zlib_huff1(n) : stbiw__zlib_huff2(n))
-
-#define stbiw__ZHASH   16384
+   stbiw_uint32 v = data[0] + (data[1] << 8) + (data[2] << 16);
+   return (v * 0x9E3779B1u) >> (32 - stbiw__ZHASH_BITS);
+}
 
-#endif // STBIW_ZLIB_COMPRESS
+static void stbiw__zlib_insert(stbiw__zlib *z, int pos)
+{
+   if (pos + 3 <= z->end) {
+      unsigned int h = stbiw__zhash(z->data + pos);
+      z->prev[pos & (stbiw__ZWINDOW-1)] = z->head[h];
+      z->head[h] = pos;
+   }
+}
 
-STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+// how many bytes at a and b are the same, up to limit; compares 8 bytes at a time while they match
+static int stbiw__zlib_match_length(unsigned char *a, unsigned char *b, int limit)
 {
-#ifdef STBIW_ZLIB_COMPRESS
-   // user provided a zlib compress implementation, use that
-   return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
-#else // use builtin
-   static unsigned short lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
-   static unsigned char  lengtheb[]= { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
-   static unsigned short distc[]   = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
-   static unsigned char  disteb[]  = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
-   unsigned int bitbuf=0;
-   int i,j, bitcount=0;
-   unsigned char *out = NULL;
-   unsigned char ***hash_table = (unsigned char***) STBIW_MALLOC(stbiw__ZHASH * sizeof(char**));
-   if (hash_table == NULL)
-      return NULL;
-   if (quality < 5) quality = 5;
+   int len = 0;
+   while (len + 8 <= limit) {
+      stbiw_uint32 x[2], y[2];
+      memcpy(x, a+len, 8);
+      memcpy(y, b+len, 8);
+      if (x[0] != y[0] || x[1] != y[1]) break;
+      len += 8;
+   }
+   while (len < limit && a[len] == b[len]) ++len;
+   return len;
+}
+
+// adds pos to the hash chains and returns the longest match there which is longer than prev_length, or 0
+static int stbiw__zlib_find_match(stbiw__zlib *z, int pos, int prev_length, int *match_dist)
+{
+   unsigned char *scan = z->data + pos;
+   int limit = z->end - pos, best = prev_length > 2 ? prev_length : 2, found = 0;
+   int chain = z->level->max_chain, nice = z->level->nice_length, cand;
+   if (limit > 258) limit = 258;
+   if (limit < 3 || best >= limit) {
+      stbiw__zlib_insert(z, pos);
+      return 0;
+   }
+   if (prev_length >= z->level->good_length) chain >>= 2;
+
+   stbiw__zlib_insert(z, pos);
+   cand = z->prev[pos & (stbiw__ZWINDOW-1)];
+   while (cand >= 0 && cand > pos - stbiw__ZWINDOW && chain-- > 0) {
+      unsigned char *match = z->data + cand;
+      if (match[best] == scan[best] && match[0] == scan[0] && match[1] == scan[1]) {
+         int len = stbiw__zlib_match_length(match, scan, limit);
+         if (len > best) {
+            best = len;
+            found = 1;
+            *match_dist = pos - cand;
+            if (len >= nice || len >= limit) break;
+         }
+      }
+      cand = z->prev[cand & (stbiw__ZWINDOW-1)];
+   }
+   // a 3 byte match far back costs more than 3 literals
+   if (!found || (best == 3 && *match_dist > 4096))
+      return 0;
+   return best;
+}
 
-   stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
-   stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
-   stbiw__zlib_add(1,1);  // BFINAL = 1
-   stbiw__zlib_add(1,2);  // BTYPE = 1 -- fixed huffman
+// huffman code lengths of at most max_bits for symbols with a nonzero freq. always makes at least
+// two codes, since some decoders reject a code with only one symbol.
+static void stbiw__zlib_huffman_lengths(const int *freq, int count, int max_bits, unsigned char *lengths)
+{
+   int sorted[288], node_freq[2*288], parent[2*288], depth[2*288], bl_count[33];
+   int n=0, i, j, leaf, node, next, total;
+   for (i=0; i < count; ++i) {
+      lengths[i] = 0;
+      if (freq[i]) {
+         // insertion sort by increasing frequency
+         for (j=n++; j > 0 && freq[sorted[j-1]] > freq[i]; --j)
+            sorted[j] = sorted[j-1];
+         sorted[j] = i;
+      }
+   }
+   if (n < 2) {
+      lengths[0] = lengths[1] = 1;
+      if (n == 1 && sorted[0] > 1) lengths[sorted[0]] = 1, lengths[1] = 0;
+      return;
+   }
 
-   for (i=0; i < stbiw__ZHASH; ++i)
-      hash_table[i] = NULL;
-
-   i=0;
-   while (i < data_len-3) {
-      // hash next 3 bytes of data to be compressed
-      int h = stbiw__zhash(data+i)&(stbiw__ZHASH-1), best=3;
-      unsigned char *bestloc = 0;
-      unsigned char **hlist = hash_table[h];
-      int n = stbiw__sbcount(hlist);
-      for (j=0; j < n; ++j) {
-         if (hlist[j]-data > i-32768) { // if entry lies within window
-            int d = stbiw__zlib_countm(hlist[j], data+i, data_len-i);
-            if (d >= best) best=d,bestloc=hlist[j];
+   // build the tree; leaves are nodes 0..n-1, and internal nodes come out in increasing frequency
+   for (i=0; i < n; ++i)
+      node_freq[i] = freq[sorted[i]];
+   leaf = 0, node = n;
+   for (next=n; next < 2*n-1; ++next) {
+      int pick[2];
+      for (j=0; j < 2; ++j)
+         pick[j] = (leaf < n && (node >= next || node_freq[leaf] <= node_freq[node])) ? leaf++ : node++;
+      node_freq[next] = node_freq[pick[0]] + node_freq[pick[1]];
+      parent[pick[0]] = parent[pick[1]] = next;
+   }
+   depth[2*n-2] = 0;
+   for (i=2*n-3; i >= 0; --i)
+      depth[i] = depth[parent[i]] + 1;
+
+   for (i=0; i <= 32; ++i)
+      bl_count[i] = 0;
+   for (i=0; i < n; ++i)
+      bl_count[depth[i] < 32 ? depth[i] : 32]++;
+
+   // move codes that are too long up to max_bits, then lengthen shorter ones until the code is complete again
+   for (i=max_bits+1; i <= 32; ++i)
+      bl_count[max_bits] += bl_count[i], bl_count[i] = 0;
+   for (total=0, i=max_bits; i > 0; --i)
+      total += bl_count[i] << (max_bits - i);
+   while (total != (1 << max_bits)) {
+      bl_count[max_bits]--;
+      for (i=max_bits-1; i > 0; --i) {
+         if (bl_count[i]) {
+            bl_count[i]--;
+            bl_count[i+1] += 2;
+            break;
          }
       }
-      // when hash table entry is too long, delete half the entries
-      if (hash_table[h] && stbiw__sbn(hash_table[h]) == 2*quality) {
-         STBIW_MEMMOVE(hash_table[h], hash_table[h]+quality, sizeof(hash_table[h][0])*quality);
-         stbiw__sbn(hash_table[h]) = quality;
+      total--;
+   }
+
+   // the most frequent symbols get the shortest codes
+   for (j=n-1, i=1; i <= max_bits; ++i)
+      while (bl_count[i]--)
+         lengths[sorted[j--]] = (unsigned char) i;
+}
+
+static void stbiw__zlib_huffman_codes(const unsigned char *lengths, int count, unsigned short *codes)
+{
+   int bl_count[16], next_code[16], code=0, i;
+   for (i=0; i < 16; ++i)
+      bl_count[i] = 0;
+   for (i=0; i < count; ++i)
+      bl_count[lengths[i]]++;
+   bl_count[0] = 0;
+   for (i=1; i < 16; ++i) {
+      code = (code + bl_count[i-1]) << 1;
+      next_code[i] = code;
+   }
+   for (i=0; i < count; ++i)
+      if (lengths[i])
+         codes[i] = (unsigned short) stbiw__zlib_bitrev(next_code[lengths[i]]++, lengths[i]);
+}
+
+// writes the tokens since the last block as a stored, fixed huffman or dynamic huffman block, whichever is smallest
+static void stbiw__zlib_flush_block(stbiw__zlib *z, int pos, int final)
+{
+   static const unsigned char cl_order[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+   static const unsigned char cl_extra[19] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,2,3,7 };
+   int litlen_freq[288], dist_freq[30], cl_freq[19];
+   unsigned char lengths[288+30], lit_lengths[288], dist_lengths[30], cl_lengths[19];
+   unsigned short lit_codes[288], dist_codes[30], cl_codes[19];
+   unsigned char rle[288+30], rle_value[288+30];
+   int hlit, hdist, hclen, rle_count=0, i, j, extra_bits=0, block_len = pos - z->block_start;
+   long long fixed_bits, dynamic_bits, stored_bits;
+
+   for (i=0; i < 288; ++i) litlen_freq[i] = 0;
+   for (i=0; i < 30; ++i) dist_freq[i] = 0;
+   for (i=0; i < 19; ++i) cl_freq[i] = 0;
+   for (i=0; i < z->token_count; ++i) {
+      stbiw__ztoken *t = &z->tokens[i];
+      litlen_freq[t->litlen]++;
+      if (t->litlen > 256) {
+         dist_freq[t->dist]++;
+         extra_bits += stbiw__zlength_extra[t->litlen-257] + stbiw__zdist_extra[t->dist];
       }
-      stbiw__sbpush(hash_table[h],data+i);
-
-      if (bestloc) {
-         // "lazy matching" - check match at *next* byte, and if it's better, do cur byte as literal
-         h = stbiw__zhash(data+i+1)&(stbiw__ZHASH-1);
-         hlist = hash_table[h];
-         n = stbiw__sbcount(hlist);
-         for (j=0; j < n; ++j) {
-            if (hlist[j]-data > i-32767) {
-               int e = stbiw__zlib_countm(hlist[j], data+i+1, data_len-i-1);
-               if (e > best) { // if next match is better, bail on current match
-                  bestloc = NULL;
-                  break;
-               }
-            }
+   }
+   litlen_freq[256] = 1; // end of block
+
+   stbiw__zlib_huffman_lengths(litlen_freq, 286, 15, lit_lengths);
+   lit_lengths[286] = lit_lengths[287] = 0;
+   stbiw__zlib_huffman_lengths(dist_freq, 30, 15, dist_lengths);
+   for (hlit=286; hlit > 257 && !lit_lengths[hlit-1]; --hlit);
+   for (hdist=30; hdist > 1 && !dist_lengths[hdist-1]; --hdist);
+
+   // run length encode the code lengths: 16 repeats the previous length, 17 and 18 are runs of zeros
+   STBIW_MEMMOVE(lengths, lit_lengths, hlit);
+   STBIW_MEMMOVE(lengths+hlit, dist_lengths, hdist);
+   for (i=0; i < hlit+hdist; ) {
+      int run = 1;
+      while (i+run < hlit+hdist && lengths[i+run] == lengths[i]) ++run;
+      if (lengths[i] == 0 && run >= 3) {
+         if (run > 138) run = 138;
+         rle[rle_count] = run >= 11 ? 18 : 17;
+         rle_value[rle_count++] = (unsigned char) (run - (run >= 11 ? 11 : 3));
+         i += run;
+      } else {
+         rle[rle_count] = lengths[i];
+         rle_value[rle_count++] = 0;
+         ++i, --run;
+         while (lengths[i-1] != 0 && run >= 3) {
+            int r = run > 6 ? 6 : run;
+            rle[rle_count] = 16;
+            rle_value[rle_count++] = (unsigned char) (r - 3);
+            i += r, run -= r;
          }
       }
+   }
+   for (i=0; i < rle_count; ++i)
+      cl_freq[rle[i]]++;
+   stbiw__zlib_huffman_lengths(cl_freq, 19, 7, cl_lengths);
+   for (hclen=19; hclen > 4 && !cl_lengths[cl_order[hclen-1]]; --hclen);
+
+   dynamic_bits = 3 + 5+5+4 + 3*hclen + extra_bits;
+   for (i=0; i < 19; ++i)
+      dynamic_bits += cl_freq[i] * (cl_lengths[i] + cl_extra[i]);
+   fixed_bits = 3 + extra_bits;
+   for (i=0; i < 286; ++i) {
+      dynamic_bits += litlen_freq[i] * lit_lengths[i];
+      fixed_bits += litlen_freq[i] * (i <= 143 ? 8 : i <= 255 ? 9 : i <= 279 ? 7 : 8);
+   }
+   for (i=0; i < 30; ++i) {
+      dynamic_bits += dist_freq[i] * dist_lengths[i];
+      fixed_bits += dist_freq[i] * 5;
+   }
+   // each stored block of up to 65535 bytes has a header, padding to a byte boundary, and LEN/NLEN
+   stored_bits = (long long) (block_len / 65535 + 1) * (3+7+32) + 8 * (long long) block_len;
+
+   if (stored_bits < fixed_bits && stored_bits < dynamic_bits) {
+      j = z->block_start;
+      do {
+         int len = pos - j > 65535 ? 65535 : pos - j;
+         stbiw__zlib_bits(z, final && j+len == pos, 1); // BFINAL
+         stbiw__zlib_bits(z, 0, 2);  // BTYPE = 0 -- stored
+         stbiw__zlib_align(z);
+         stbiw__zlib_bits(z, len, 16);
+         stbiw__zlib_bits(z, len ^ 0xffff, 16);
+         if (stbiw__zlib_grow(z, len)) {
+            STBIW_MEMMOVE(z->out + z->out_len, z->data + j, len);
+            z->out_len += len;
+         }
+         j += len;
+      } while (j < pos);
+   } else {
+      stbiw__zlib_bits(z, final, 1); // BFINAL
+      if (fixed_bits <= dynamic_bits) {
+         stbiw__zlib_bits(z, 1, 2);  // BTYPE = 1 -- fixed huffman
+         for (i=0; i < 288; ++i)
+            lit_lengths[i] = (unsigned char) (i <= 143 ? 8 : i <= 255 ? 9 : i <= 279 ? 7 : 8);
+         for (i=0; i < 30; ++i)
+            dist_lengths[i] = 5;
+      } else {
+         stbiw__zlib_bits(z, 2, 2);  // BTYPE = 2 -- dynamic huffman
+         stbiw__zlib_bits(z, hlit - 257, 5);
+         stbiw__zlib_bits(z, hdist - 1, 5);
+         stbiw__zlib_bits(z, hclen - 4, 4);
+         for (i=0; i < hclen; ++i)
+            stbiw__zlib_bits(z, cl_lengths[cl_order[i]], 3);
+         stbiw__zlib_huffman_codes(cl_lengths, 19, cl_codes);
+         for (i=0; i < rle_count; ++i) {
+            stbiw__zlib_bits(z, cl_codes[rle[i]], cl_lengths[rle[i]]);
+            if (cl_extra[rle[i]]) stbiw__zlib_bits(z, rle_value[i], cl_extra[rle[i]]);
+         }
+      }
+      stbiw__zlib_huffman_codes(lit_lengths, 288, lit_codes);
+      stbiw__zlib_huffman_codes(dist_lengths, 30, dist_codes);
+      for (i=0; i < z->token_count; ++i) {
+         stbiw__ztoken *t = &z->tokens[i];
+         stbiw__zlib_bits(z, lit_codes[t->litlen], lit_lengths[t->litlen]);
+         if (t->litlen > 256) {
+            if (stbiw__zlength_extra[t->litlen-257]) stbiw__zlib_bits(z, t->length, stbiw__zlength_extra[t->litlen-257]);
+            stbiw__zlib_bits(z, dist_codes[t->dist], dist_lengths[t->dist]);
+            if (stbiw__zdist_extra[t->dist]) stbiw__zlib_bits(z, t->distance, stbiw__zdist_extra[t->dist]);
+         }
+      }
+      stbiw__zlib_bits(z, lit_codes[256], lit_lengths[256]); // end of block
+   }
 
-      if (bestloc) {
-         int d = (int) (data+i - bestloc); // distance back
-         STBIW_ASSERT(d <= 32767 && best <= 258);
-         for (j=0; best > lengthc[j+1]-1; ++j);
-         stbiw__zlib_huff(j+257);
-         if (lengtheb[j]) stbiw__zlib_add(best - lengthc[j], lengtheb[j]);
-         for (j=0; d > distc[j+1]-1; ++j);
-         stbiw__zlib_add(stbiw__zlib_bitrev(j,5),5);
-         if (disteb[j]) stbiw__zlib_add(d - distc[j], disteb[j]);
-         i += best;
+   z->token_count = 0;
+   z->block_start = pos;
+}
+
+// queues a literal (length 0) or match starting at pos
+static void stbiw__zlib_token(stbiw__zlib *z, int pos, int length, int dist)
+{
+   stbiw__ztoken *t;
+   int j;
+   if (z->token_count == stbiw__ZBLOCK_TOKENS)
+      stbiw__zlib_flush_block(z, pos, 0);
+   t = &z->tokens[z->token_count++];
+   if (!length) {
+      t->litlen = z->data[pos];
+      return;
+   }
+   STBIW_ASSERT(dist <= 32767 && length <= 258);
+   for (j=0; length > stbiw__zlength_base[j+1]-1; ++j);
+   t->litlen = (unsigned short) (257 + j);
+   t->length = (unsigned short) (length - stbiw__zlength_base[j]);
+   for (j=0; dist > stbiw__zdist_base[j+1]-1; ++j);
+   t->dist = (unsigned short) j;
+   t->distance = (unsigned short) (dist - stbiw__zdist_base[j]);
+}
+
+// compresses data[start..end) into raw DEFLATE blocks, in memory from the options' allocator. matches
+// can reach back into the 32K before start, so a band loses almost nothing to being compressed on its
+// own. the last band ends the stream, the others end with an empty stored block ("sync flush") so the
+// next band starts on a byte boundary. quality is the level, 1 (fastest) to 9 (smallest). returns NULL
+// on allocation failure.
+static unsigned char *stbiw__zlib_compress_band(const stbi_write_png_options *options, unsigned char *data, int start, int end, int quality, int last, int *out_len)
+{
+   stbiw__zlib z;
+   int i, len=0, dist=0, have_match=0;
+   void *mem = stbiw__png_alloc(options, sizeof(int) * (stbiw__ZHASH + stbiw__ZWINDOW) + sizeof(stbiw__ztoken) * stbiw__ZBLOCK_TOKENS);
+   if (mem == NULL)
+      return NULL;
+   if (quality < 1) quality = 1;
+   if (quality > 9) quality = 9;
+
+   z.options = options;
+   z.out = NULL;
+   z.out_len = 0;
+   z.out_cap = 0;
+   z.failed = 0;
+   // the stream is usually a small fraction of the input
+   stbiw__zlib_grow(&z, (end - start) / 8 + 64);
+   z.bitbuf = 0;
+   z.bitcount = 0;
+   z.data = data;
+   z.end = end;
+   z.block_start = start;
+   z.level = &stbiw__zlevels[quality];
+   z.head = (int *) mem;
+   z.prev = z.head + stbiw__ZHASH;
+   z.tokens = (stbiw__ztoken *) (z.prev + stbiw__ZWINDOW);
+   z.token_count = 0;
+
+   for (i=0; i < stbiw__ZHASH; ++i)
+      z.head[i] = -1;
+   // fill the hash chains from the window before the band
+   for (i = start > stbiw__ZWINDOW ? start-stbiw__ZWINDOW : 0; i < start; ++i)
+      stbiw__zlib_insert(&z, i);
+
+   i=start;
+   while (i < end) {
+      int next = i+1; // first position not in the hash chains yet
+      if (!have_match)
+         len = stbiw__zlib_find_match(&z, i, 0, &dist);
+      have_match = 0;
+
+      if (len && len < z.level->lazy_length) {
+         // "lazy matching" - if the match at the next byte is longer, do cur byte as literal
+         int next_dist, next_len = stbiw__zlib_find_match(&z, i+1, len, &next_dist);
+         next = i+2;
+         if (next_len) {
+            stbiw__zlib_token(&z, i, 0, 0);
+            ++i;
+            len = next_len;
+            dist = next_dist;
+            have_match = 1;
+            continue;
+         }
+      }
+
+      if (len) {
+         stbiw__zlib_token(&z, i, len, dist);
+         for (; next < i+len; ++next)
+            stbiw__zlib_insert(&z, next);
+         i += len;
       } else {
-         stbiw__zlib_huffb(data[i]);
+         stbiw__zlib_token(&z, i, 0, 0);
          ++i;
       }
    }
-   // write out final bytes
-   for (;i < data_len; ++i)
-      stbiw__zlib_huffb(data[i]);
-   stbiw__zlib_huff(256); // end of block
-   // pad with 0 bits to byte boundary
-   while (bitcount)
-      stbiw__zlib_add(0,1);
+   stbiw__zlib_flush_block(&z, end, last);
+
+   if (!last) {
+      // sync flush: an empty stored block, whose LEN and NLEN start on a byte boundary
+      stbiw__zlib_bits(&z, 0, 1);  // BFINAL = 0
+      stbiw__zlib_bits(&z, 0, 2);  // BTYPE = 0 -- stored
+      stbiw__zlib_align(&z);
+      stbiw__zlib_bits(&z, 0x0000, 16);
+      stbiw__zlib_bits(&z, 0xffff, 16);
+   }
+   stbiw__zlib_align(&z);
 
-   for (i=0; i < stbiw__ZHASH; ++i)
-      (void) stbiw__sbfree(hash_table[i]);
-   STBIW_FREE(hash_table);
+   stbiw__png_free(options, mem);
+   if (z.failed) {
+      stbiw__png_free(options, z.out);
+      return NULL;
+   }
+   *out_len = z.out_len;
+   return z.out;
+}
 
-   {
-      // compute adler32 on input
-      unsigned int s1=1, s2=0;
-      int blocklen = (int) (data_len % 5552);
-      j=0;
-      while (j < data_len) {
-         for (i=0; i < blocklen; ++i) s1 += data[j+i], s2 += s1;
-         s1 %= 65521, s2 %= 65521;
-         j += blocklen;
-         blocklen = 5552;
+static unsigned int stbiw__adler32(unsigned int adler, unsigned char *data, int data_len)
+{
+   unsigned int s1 = adler & 0xffff, s2 = adler >> 16;
+   int blocklen = (int) (data_len % 5552);
+   int i, j=0;
+   while (j < data_len) {
+      i = 0;
+#ifdef STBIW_SSE2
+      {
+         // 16 bytes at a time: s1 gains their sum, s2 gains 16*s1 plus the bytes weighted 16,15,...,1.
+         // sums stay under 2^32 within a block of 5552 bytes, the same bound the scalar loop relies on.
+         const __m128i weights_lo = _mm_set_epi16(9,10,11,12,13,14,15,16), weights_hi = _mm_set_epi16(1,2,3,4,5,6,7,8);
+         __m128i zero = _mm_setzero_si128(), vs1 = zero, vs2 = zero, prefix = zero;
+         unsigned int sums[4];
+         for (; i+16 <= blocklen; i += 16) {
+            __m128i v = _mm_loadu_si128((__m128i *) (data+j+i));
+            prefix = _mm_add_epi32(prefix, vs1);
+            vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(v, zero));
+            vs2 = _mm_add_epi32(vs2, _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights_lo),
+                                                   _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights_hi)));
+         }
+         vs2 = _mm_add_epi32(vs2, _mm_slli_epi32(prefix, 4));
+         _mm_storeu_si128((__m128i *) sums, vs2);
+         s2 += s1 * (unsigned int) i + sums[0] + sums[1] + sums[2] + sums[3];
+         _mm_storeu_si128((__m128i *) sums, vs1);
+         s1 += sums[0] + sums[2];
       }
-      stbiw__sbpush(out, STBIW_UCHAR(s2 >> 8));
-      stbiw__sbpush(out, STBIW_UCHAR(s2));
-      stbiw__sbpush(out, STBIW_UCHAR(s1 >> 8));
-      stbiw__sbpush(out, STBIW_UCHAR(s1));
-   }
-   *out_len = stbiw__sbn(out);
-   // make returned pointer freeable
-   STBIW_MEMMOVE(stbiw__sbraw(out), out, *out_len);
-   return (unsigned char *) stbiw__sbraw(out);
+#endif
+      for (; i < blocklen; ++i) s1 += data[j+i], s2 += s1;
+      s1 %= 65521, s2 %= 65521;
+      j += blocklen;
+      blocklen = 5552;
+   }
+   return (s2 << 16) | s1;
+}
+
+// adler32 of two buffers back to back, from the adler32 of each and the length of the second
+static unsigned int stbiw__adler32_combine(unsigned int adler1, unsigned int adler2, int len2)
+{
+   unsigned int rem = (unsigned int) len2 % 65521;
+   unsigned int s1 = adler1 & 0xffff;
+   unsigned int s2 = (rem * s1) % 65521;
+   s1 += (adler2 & 0xffff) + 65521 - 1;
+   s2 += (adler1 >> 16) + (adler2 >> 16) + 65521 - rem;
+   if (s1 >= 65521) s1 -= 65521;
+   if (s1 >= 65521) s1 -= 65521;
+   if (s2 >= 65521*2) s2 -= 65521*2;
+   if (s2 >= 65521) s2 -= 65521;
+   return (s2 << 16) | s1;
+}
+#endif // STBIW_ZLIB_COMPRESS
+
+STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+{
+#ifdef STBIW_ZLIB_COMPRESS
+   // user provided a zlib compress implementation, use that
+   return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
+#else // use builtin
+   stbi_write_png_options options;
+   unsigned char *deflate, *out;
+   unsigned int adler;
+   int deflate_len;
+   stbi_write_png_default_options(&options);
+   deflate = stbiw__zlib_compress_band(&options, data, 0, data_len, quality, 1, &deflate_len);
+   if (!deflate)
+      return NULL;
+
+   out = (unsigned char *) STBIW_MALLOC(2 + deflate_len + 4);
+   if (out) {
+      adler = stbiw__adler32(1, data, data_len);
+      out[0] = 0x78;   // DEFLATE 32K window
+      out[1] = 0x5e;   // FLEVEL = 1
+      STBIW_MEMMOVE(out+2, deflate, deflate_len);
+      out[2+deflate_len+0] = STBIW_UCHAR(adler >> 24);
+      out[2+deflate_len+1] = STBIW_UCHAR(adler >> 16);
+      out[2+deflate_len+2] = STBIW_UCHAR(adler >> 8);
+      out[2+deflate_len+3] = STBIW_UCHAR(adler);
+      *out_len = 2 + deflate_len + 4;
+   }
+   STBIW_FREE(deflate);
+   return out;
 #endif // STBIW_ZLIB_COMPRESS
 }
 
-static unsigned int stbiw__crc32(unsigned char *buffer, int len)
+#ifndef STBIW_CRC32
+// crc_table[0] is the usual byte at a time table; crc_table[k][i] is i's crc pushed through k more zero bytes
+static const unsigned int stbiw__crc_table[8][256] =
 {
-#ifdef STBIW_CRC32
-    return STBIW_CRC32(buffer, len);
-#else
-   static unsigned int crc_table[256] =
    {
       0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
-      0x0eDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
+      0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
       0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
       0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
       0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
@@ -1010,13 +1520,313 @@ static unsigned int stbiw__crc32(unsigned char *buffer, int len)
       0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
       0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
       0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
-   };
+   },
+   {
+      0x00000000, 0x191B3141, 0x32366282, 0x2B2D53C3, 0x646CC504, 0x7D77F445, 0x565AA786, 0x4F4196C7,
+      0xC8D98A08, 0xD1C2BB49, 0xFAEFE88A, 0xE3F4D9CB, 0xACB54F0C, 0xB5AE7E4D, 0x9E832D8E, 0x87981CCF,
+      0x4AC21251, 0x53D92310, 0x78F470D3, 0x61EF4192, 0x2EAED755, 0x37B5E614, 0x1C98B5D7, 0x05838496,
+      0x821B9859, 0x9B00A918, 0xB02DFADB, 0xA936CB9A, 0xE6775D5D, 0xFF6C6C1C, 0xD4413FDF, 0xCD5A0E9E,
+      0x958424A2, 0x8C9F15E3, 0xA7B24620, 0xBEA97761, 0xF1E8E1A6, 0xE8F3D0E7, 0xC3DE8324, 0xDAC5B265,
+      0x5D5DAEAA, 0x44469FEB, 0x6F6BCC28, 0x7670FD69, 0x39316BAE, 0x202A5AEF, 0x0B07092C, 0x121C386D,
+      0xDF4636F3, 0xC65D07B2, 0xED705471, 0xF46B6530, 0xBB2AF3F7, 0xA231C2B6, 0x891C9175, 0x9007A034,
+      0x179FBCFB, 0x0E848DBA, 0x25A9DE79, 0x3CB2EF38, 0x73F379FF, 0x6AE848BE, 0x41C51B7D, 0x58DE2A3C,
+      0xF0794F05, 0xE9627E44, 0xC24F2D87, 0xDB541CC6, 0x94158A01, 0x8D0EBB40, 0xA623E883, 0xBF38D9C2,
+      0x38A0C50D, 0x21BBF44C, 0x0A96A78F, 0x138D96CE, 0x5CCC0009, 0x45D73148, 0x6EFA628B, 0x77E153CA,
+      0xBABB5D54, 0xA3A06C15, 0x888D3FD6, 0x91960E97, 0xDED79850, 0xC7CCA911, 0xECE1FAD2, 0xF5FACB93,
+      0x7262D75C, 0x6B79E61D, 0x4054B5DE, 0x594F849F, 0x160E1258, 0x0F152319, 0x243870DA, 0x3D23419B,
+      0x65FD6BA7, 0x7CE65AE6, 0x57CB0925, 0x4ED03864, 0x0191AEA3, 0x188A9FE2, 0x33A7CC21, 0x2ABCFD60,
+      0xAD24E1AF, 0xB43FD0EE, 0x9F12832D, 0x8609B26C, 0xC94824AB, 0xD05315EA, 0xFB7E4629, 0xE2657768,
+      0x2F3F79F6, 0x362448B7, 0x1D091B74, 0x04122A35, 0x4B53BCF2, 0x52488DB3, 0x7965DE70, 0x607EEF31,
+      0xE7E6F3FE, 0xFEFDC2BF, 0xD5D0917C, 0xCCCBA03D, 0x838A36FA, 0x9A9107BB, 0xB1BC5478, 0xA8A76539,
+      0x3B83984B, 0x2298A90A, 0x09B5FAC9, 0x10AECB88, 0x5FEF5D4F, 0x46F46C0E, 0x6DD93FCD, 0x74C20E8C,
+      0xF35A1243, 0xEA412302, 0xC16C70C1, 0xD8774180, 0x9736D747, 0x8E2DE606, 0xA500B5C5, 0xBC1B8484,
+      0x71418A1A, 0x685ABB5B, 0x4377E898, 0x5A6CD9D9, 0x152D4F1E, 0x0C367E5F, 0x271B2D9C, 0x3E001CDD,
+      0xB9980012, 0xA0833153, 0x8BAE6290, 0x92B553D1, 0xDDF4C516, 0xC4EFF457, 0xEFC2A794, 0xF6D996D5,
+      0xAE07BCE9, 0xB71C8DA8, 0x9C31DE6B, 0x852AEF2A, 0xCA6B79ED, 0xD37048AC, 0xF85D1B6F, 0xE1462A2E,
+      0x66DE36E1, 0x7FC507A0, 0x54E85463, 0x4DF36522, 0x02B2F3E5, 0x1BA9C2A4, 0x30849167, 0x299FA026,
+      0xE4C5AEB8, 0xFDDE9FF9, 0xD6F3CC3A, 0xCFE8FD7B, 0x80A96BBC, 0x99B25AFD, 0xB29F093E, 0xAB84387F,
+      0x2C1C24B0, 0x350715F1, 0x1E2A4632, 0x07317773, 0x4870E1B4, 0x516BD0F5, 0x7A468336, 0x635DB277,
+      0xCBFAD74E, 0xD2E1E60F, 0xF9CCB5CC, 0xE0D7848D, 0xAF96124A, 0xB68D230B, 0x9DA070C8, 0x84BB4189,
+      0x03235D46, 0x1A386C07, 0x31153FC4, 0x280E0E85, 0x674F9842, 0x7E54A903, 0x5579FAC0, 0x4C62CB81,
+      0x8138C51F, 0x9823F45E, 0xB30EA79D, 0xAA1596DC, 0xE554001B, 0xFC4F315A, 0xD7626299, 0xCE7953D8,
+      0x49E14F17, 0x50FA7E56, 0x7BD72D95, 0x62CC1CD4, 0x2D8D8A13, 0x3496BB52, 0x1FBBE891, 0x06A0D9D0,
+      0x5E7EF3EC, 0x4765C2AD, 0x6C48916E, 0x7553A02F, 0x3A1236E8, 0x230907A9, 0x0824546A, 0x113F652B,
+      0x96A779E4, 0x8FBC48A5, 0xA4911B66, 0xBD8A2A27, 0xF2CBBCE0, 0xEBD08DA1, 0xC0FDDE62, 0xD9E6EF23,
+      0x14BCE1BD, 0x0DA7D0FC, 0x268A833F, 0x3F91B27E, 0x70D024B9, 0x69CB15F8, 0x42E6463B, 0x5BFD777A,
+      0xDC656BB5, 0xC57E5AF4, 0xEE530937, 0xF7483876, 0xB809AEB1, 0xA1129FF0, 0x8A3FCC33, 0x9324FD72
+   },
+   {
+      0x00000000, 0x01C26A37, 0x0384D46E, 0x0246BE59, 0x0709A8DC, 0x06CBC2EB, 0x048D7CB2, 0x054F1685,
+      0x0E1351B8, 0x0FD13B8F, 0x0D9785D6, 0x0C55EFE1, 0x091AF964, 0x08D89353, 0x0A9E2D0A, 0x0B5C473D,
+      0x1C26A370, 0x1DE4C947, 0x1FA2771E, 0x1E601D29, 0x1B2F0BAC, 0x1AED619B, 0x18ABDFC2, 0x1969B5F5,
+      0x1235F2C8, 0x13F798FF, 0x11B126A6, 0x10734C91, 0x153C5A14, 0x14FE3023, 0x16B88E7A, 0x177AE44D,
+      0x384D46E0, 0x398F2CD7, 0x3BC9928E, 0x3A0BF8B9, 0x3F44EE3C, 0x3E86840B, 0x3CC03A52, 0x3D025065,
+      0x365E1758, 0x379C7D6F, 0x35DAC336, 0x3418A901, 0x3157BF84, 0x3095D5B3, 0x32D36BEA, 0x331101DD,
+      0x246BE590, 0x25A98FA7, 0x27EF31FE, 0x262D5BC9, 0x23624D4C, 0x22A0277B, 0x20E69922, 0x2124F315,
+      0x2A78B428, 0x2BBADE1F, 0x29FC6046, 0x283E0A71, 0x2D711CF4, 0x2CB376C3, 0x2EF5C89A, 0x2F37A2AD,
+      0x709A8DC0, 0x7158E7F7, 0x731E59AE, 0x72DC3399, 0x7793251C, 0x76514F2B, 0x7417F172, 0x75D59B45,
+      0x7E89DC78, 0x7F4BB64F, 0x7D0D0816, 0x7CCF6221, 0x798074A4, 0x78421E93, 0x7A04A0CA, 0x7BC6CAFD,
+      0x6CBC2EB0, 0x6D7E4487, 0x6F38FADE, 0x6EFA90E9, 0x6BB5866C, 0x6A77EC5B, 0x68315202, 0x69F33835,
+      0x62AF7F08, 0x636D153F, 0x612BAB66, 0x60E9C151, 0x65A6D7D4, 0x6464BDE3, 0x662203BA, 0x67E0698D,
+      0x48D7CB20, 0x4915A117, 0x4B531F4E, 0x4A917579, 0x4FDE63FC, 0x4E1C09CB, 0x4C5AB792, 0x4D98DDA5,
+      0x46C49A98, 0x4706F0AF, 0x45404EF6, 0x448224C1, 0x41CD3244, 0x400F5873, 0x4249E62A, 0x438B8C1D,
+      0x54F16850, 0x55330267, 0x5775BC3E, 0x56B7D609, 0x53F8C08C, 0x523AAABB, 0x507C14E2, 0x51BE7ED5,
+      0x5AE239E8, 0x5B2053DF, 0x5966ED86, 0x58A487B1, 0x5DEB9134, 0x5C29FB03, 0x5E6F455A, 0x5FAD2F6D,
+      0xE1351B80, 0xE0F771B7, 0xE2B1CFEE, 0xE373A5D9, 0xE63CB35C, 0xE7FED96B, 0xE5B86732, 0xE47A0D05,
+      0xEF264A38, 0xEEE4200F, 0xECA29E56, 0xED60F461, 0xE82FE2E4, 0xE9ED88D3, 0xEBAB368A, 0xEA695CBD,
+      0xFD13B8F0, 0xFCD1D2C7, 0xFE976C9E, 0xFF5506A9, 0xFA1A102C, 0xFBD87A1B, 0xF99EC442, 0xF85CAE75,
+      0xF300E948, 0xF2C2837F, 0xF0843D26, 0xF1465711, 0xF4094194, 0xF5CB2BA3, 0xF78D95FA, 0xF64FFFCD,
+      0xD9785D60, 0xD8BA3757, 0xDAFC890E, 0xDB3EE339, 0xDE71F5BC, 0xDFB39F8B, 0xDDF521D2, 0xDC374BE5,
+      0xD76B0CD8, 0xD6A966EF, 0xD4EFD8B6, 0xD52DB281, 0xD062A404, 0xD1A0CE33, 0xD3E6706A, 0xD2241A5D,
+      0xC55EFE10, 0xC49C9427, 0xC6DA2A7E, 0xC7184049, 0xC25756CC, 0xC3953CFB, 0xC1D382A2, 0xC011E895,
+      0xCB4DAFA8, 0xCA8FC59F, 0xC8C97BC6, 0xC90B11F1, 0xCC440774, 0xCD866D43, 0xCFC0D31A, 0xCE02B92D,
+      0x91AF9640, 0x906DFC77, 0x922B422E, 0x93E92819, 0x96A63E9C, 0x976454AB, 0x9522EAF2, 0x94E080C5,
+      0x9FBCC7F8, 0x9E7EADCF, 0x9C381396, 0x9DFA79A1, 0x98B56F24, 0x99770513, 0x9B31BB4A, 0x9AF3D17D,
+      0x8D893530, 0x8C4B5F07, 0x8E0DE15E, 0x8FCF8B69, 0x8A809DEC, 0x8B42F7DB, 0x89044982, 0x88C623B5,
+      0x839A6488, 0x82580EBF, 0x801EB0E6, 0x81DCDAD1, 0x8493CC54, 0x8551A663, 0x8717183A, 0x86D5720D,
+      0xA9E2D0A0, 0xA820BA97, 0xAA6604CE, 0xABA46EF9, 0xAEEB787C, 0xAF29124B, 0xAD6FAC12, 0xACADC625,
+      0xA7F18118, 0xA633EB2F, 0xA4755576, 0xA5B73F41, 0xA0F829C4, 0xA13A43F3, 0xA37CFDAA, 0xA2BE979D,
+      0xB5C473D0, 0xB40619E7, 0xB640A7BE, 0xB782CD89, 0xB2CDDB0C, 0xB30FB13B, 0xB1490F62, 0xB08B6555,
+      0xBBD72268, 0xBA15485F, 0xB853F606, 0xB9919C31, 0xBCDE8AB4, 0xBD1CE083, 0xBF5A5EDA, 0xBE9834ED
+   },
+   {
+      0x00000000, 0xB8BC6765, 0xAA09C88B, 0x12B5AFEE, 0x8F629757, 0x37DEF032, 0x256B5FDC, 0x9DD738B9,
+      0xC5B428EF, 0x7D084F8A, 0x6FBDE064, 0xD7018701, 0x4AD6BFB8, 0xF26AD8DD, 0xE0DF7733, 0x58631056,
+      0x5019579F, 0xE8A530FA, 0xFA109F14, 0x42ACF871, 0xDF7BC0C8, 0x67C7A7AD, 0x75720843, 0xCDCE6F26,
+      0x95AD7F70, 0x2D111815, 0x3FA4B7FB, 0x8718D09E, 0x1ACFE827, 0xA2738F42, 0xB0C620AC, 0x087A47C9,
+      0xA032AF3E, 0x188EC85B, 0x0A3B67B5, 0xB28700D0, 0x2F503869, 0x97EC5F0C, 0x8559F0E2, 0x3DE59787,
+      0x658687D1, 0xDD3AE0B4, 0xCF8F4F5A, 0x7733283F, 0xEAE41086, 0x525877E3, 0x40EDD80D, 0xF851BF68,
+      0xF02BF8A1, 0x48979FC4, 0x5A22302A, 0xE29E574F, 0x7F496FF6, 0xC7F50893, 0xD540A77D, 0x6DFCC018,
+      0x359FD04E, 0x8D23B72B, 0x9F9618C5, 0x272A7FA0, 0xBAFD4719, 0x0241207C, 0x10F48F92, 0xA848E8F7,
+      0x9B14583D, 0x23A83F58, 0x311D90B6, 0x89A1F7D3, 0x1476CF6A, 0xACCAA80F, 0xBE7F07E1, 0x06C36084,
+      0x5EA070D2, 0xE61C17B7, 0xF4A9B859, 0x4C15DF3C, 0xD1C2E785, 0x697E80E0, 0x7BCB2F0E, 0xC377486B,
+      0xCB0D0FA2, 0x73B168C7, 0x6104C729, 0xD9B8A04C, 0x446F98F5, 0xFCD3FF90, 0xEE66507E, 0x56DA371B,
+      0x0EB9274D, 0xB6054028, 0xA4B0EFC6, 0x1C0C88A3, 0x81DBB01A, 0x3967D77F, 0x2BD27891, 0x936E1FF4,
+      0x3B26F703, 0x839A9066, 0x912F3F88, 0x299358ED, 0xB4446054, 0x0CF80731, 0x1E4DA8DF, 0xA6F1CFBA,
+      0xFE92DFEC, 0x462EB889, 0x549B1767, 0xEC277002, 0x71F048BB, 0xC94C2FDE, 0xDBF98030, 0x6345E755,
+      0x6B3FA09C, 0xD383C7F9, 0xC1366817, 0x798A0F72, 0xE45D37CB, 0x5CE150AE, 0x4E54FF40, 0xF6E89825,
+      0xAE8B8873, 0x1637EF16, 0x048240F8, 0xBC3E279D, 0x21E91F24, 0x99557841, 0x8BE0D7AF, 0x335CB0CA,
+      0xED59B63B, 0x55E5D15E, 0x47507EB0, 0xFFEC19D5, 0x623B216C, 0xDA874609, 0xC832E9E7, 0x708E8E82,
+      0x28ED9ED4, 0x9051F9B1, 0x82E4565F, 0x3A58313A, 0xA78F0983, 0x1F336EE6, 0x0D86C108, 0xB53AA66D,
+      0xBD40E1A4, 0x05FC86C1, 0x1749292F, 0xAFF54E4A, 0x322276F3, 0x8A9E1196, 0x982BBE78, 0x2097D91D,
+      0x78F4C94B, 0xC048AE2E, 0xD2FD01C0, 0x6A4166A5, 0xF7965E1C, 0x4F2A3979, 0x5D9F9697, 0xE523F1F2,
+      0x4D6B1905, 0xF5D77E60, 0xE762D18E, 0x5FDEB6EB, 0xC2098E52, 0x7AB5E937, 0x680046D9, 0xD0BC21BC,
+      0x88DF31EA, 0x3063568F, 0x22D6F961, 0x9A6A9E04, 0x07BDA6BD, 0xBF01C1D8, 0xADB46E36, 0x15080953,
+      0x1D724E9A, 0xA5CE29FF, 0xB77B8611, 0x0FC7E174, 0x9210D9CD, 0x2AACBEA8, 0x38191146, 0x80A57623,
+      0xD8C66675, 0x607A0110, 0x72CFAEFE, 0xCA73C99B, 0x57A4F122, 0xEF189647, 0xFDAD39A9, 0x45115ECC,
+      0x764DEE06, 0xCEF18963, 0xDC44268D, 0x64F841E8, 0xF92F7951, 0x41931E34, 0x5326B1DA, 0xEB9AD6BF,
+      0xB3F9C6E9, 0x0B45A18C, 0x19F00E62, 0xA14C6907, 0x3C9B51BE, 0x842736DB, 0x96929935, 0x2E2EFE50,
+      0x2654B999, 0x9EE8DEFC, 0x8C5D7112, 0x34E11677, 0xA9362ECE, 0x118A49AB, 0x033FE645, 0xBB838120,
+      0xE3E09176, 0x5B5CF613, 0x49E959FD, 0xF1553E98, 0x6C820621, 0xD43E6144, 0xC68BCEAA, 0x7E37A9CF,
+      0xD67F4138, 0x6EC3265D, 0x7C7689B3, 0xC4CAEED6, 0x591DD66F, 0xE1A1B10A, 0xF3141EE4, 0x4BA87981,
+      0x13CB69D7, 0xAB770EB2, 0xB9C2A15C, 0x017EC639, 0x9CA9FE80, 0x241599E5, 0x36A0360B, 0x8E1C516E,
+      0x866616A7, 0x3EDA71C2, 0x2C6FDE2C, 0x94D3B949, 0x090481F0, 0xB1B8E695, 0xA30D497B, 0x1BB12E1E,
+      0x43D23E48, 0xFB6E592D, 0xE9DBF6C3, 0x516791A6, 0xCCB0A91F, 0x740CCE7A, 0x66B96194, 0xDE0506F1
+   },
+   {
+      0x00000000, 0x3D6029B0, 0x7AC05360, 0x47A07AD0, 0xF580A6C0, 0xC8E08F70, 0x8F40F5A0, 0xB220DC10,
+      0x30704BC1, 0x0D106271, 0x4AB018A1, 0x77D03111, 0xC5F0ED01, 0xF890C4B1, 0xBF30BE61, 0x825097D1,
+      0x60E09782, 0x5D80BE32, 0x1A20C4E2, 0x2740ED52, 0x95603142, 0xA80018F2, 0xEFA06222, 0xD2C04B92,
+      0x5090DC43, 0x6DF0F5F3, 0x2A508F23, 0x1730A693, 0xA5107A83, 0x98705333, 0xDFD029E3, 0xE2B00053,
+      0xC1C12F04, 0xFCA106B4, 0xBB017C64, 0x866155D4, 0x344189C4, 0x0921A074, 0x4E81DAA4, 0x73E1F314,
+      0xF1B164C5, 0xCCD14D75, 0x8B7137A5, 0xB6111E15, 0x0431C205, 0x3951EBB5, 0x7EF19165, 0x4391B8D5,
+      0xA121B886, 0x9C419136, 0xDBE1EBE6, 0xE681C256, 0x54A11E46, 0x69C137F6, 0x2E614D26, 0x13016496,
+      0x9151F347, 0xAC31DAF7, 0xEB91A027, 0xD6F18997, 0x64D15587, 0x59B17C37, 0x1E1106E7, 0x23712F57,
+      0x58F35849, 0x659371F9, 0x22330B29, 0x1F532299, 0xAD73FE89, 0x9013D739, 0xD7B3ADE9, 0xEAD38459,
+      0x68831388, 0x55E33A38, 0x124340E8, 0x2F236958, 0x9D03B548, 0xA0639CF8, 0xE7C3E628, 0xDAA3CF98,
+      0x3813CFCB, 0x0573E67B, 0x42D39CAB, 0x7FB3B51B, 0xCD93690B, 0xF0F340BB, 0xB7533A6B, 0x8A3313DB,
+      0x0863840A, 0x3503ADBA, 0x72A3D76A, 0x4FC3FEDA, 0xFDE322CA, 0xC0830B7A, 0x872371AA, 0xBA43581A,
+      0x9932774D, 0xA4525EFD, 0xE3F2242D, 0xDE920D9D, 0x6CB2D18D, 0x51D2F83D, 0x167282ED, 0x2B12AB5D,
+      0xA9423C8C, 0x9422153C, 0xD3826FEC, 0xEEE2465C, 0x5CC29A4C, 0x61A2B3FC, 0x2602C92C, 0x1B62E09C,
+      0xF9D2E0CF, 0xC4B2C97F, 0x8312B3AF, 0xBE729A1F, 0x0C52460F, 0x31326FBF, 0x7692156F, 0x4BF23CDF,
+      0xC9A2AB0E, 0xF4C282BE, 0xB362F86E, 0x8E02D1DE, 0x3C220DCE, 0x0142247E, 0x46E25EAE, 0x7B82771E,
+      0xB1E6B092, 0x8C869922, 0xCB26E3F2, 0xF646CA42, 0x44661652, 0x79063FE2, 0x3EA64532, 0x03C66C82,
+      0x8196FB53, 0xBCF6D2E3, 0xFB56A833, 0xC6368183, 0x74165D93, 0x49767423, 0x0ED60EF3, 0x33B62743,
+      0xD1062710, 0xEC660EA0, 0xABC67470, 0x96A65DC0, 0x248681D0, 0x19E6A860, 0x5E46D2B0, 0x6326FB00,
+      0xE1766CD1, 0xDC164561, 0x9BB63FB1, 0xA6D61601, 0x14F6CA11, 0x2996E3A1, 0x6E369971, 0x5356B0C1,
+      0x70279F96, 0x4D47B626, 0x0AE7CCF6, 0x3787E546, 0x85A73956, 0xB8C710E6, 0xFF676A36, 0xC2074386,
+      0x4057D457, 0x7D37FDE7, 0x3A978737, 0x07F7AE87, 0xB5D77297, 0x88B75B27, 0xCF1721F7, 0xF2770847,
+      0x10C70814, 0x2DA721A4, 0x6A075B74, 0x576772C4, 0xE547AED4, 0xD8278764, 0x9F87FDB4, 0xA2E7D404,
+      0x20B743D5, 0x1DD76A65, 0x5A7710B5, 0x67173905, 0xD537E515, 0xE857CCA5, 0xAFF7B675, 0x92979FC5,
+      0xE915E8DB, 0xD475C16B, 0x93D5BBBB, 0xAEB5920B, 0x1C954E1B, 0x21F567AB, 0x66551D7B, 0x5B3534CB,
+      0xD965A31A, 0xE4058AAA, 0xA3A5F07A, 0x9EC5D9CA, 0x2CE505DA, 0x11852C6A, 0x562556BA, 0x6B457F0A,
+      0x89F57F59, 0xB49556E9, 0xF3352C39, 0xCE550589, 0x7C75D999, 0x4115F029, 0x06B58AF9, 0x3BD5A349,
+      0xB9853498, 0x84E51D28, 0xC34567F8, 0xFE254E48, 0x4C059258, 0x7165BBE8, 0x36C5C138, 0x0BA5E888,
+      0x28D4C7DF, 0x15B4EE6F, 0x521494BF, 0x6F74BD0F, 0xDD54611F, 0xE03448AF, 0xA794327F, 0x9AF41BCF,
+      0x18A48C1E, 0x25C4A5AE, 0x6264DF7E, 0x5F04F6CE, 0xED242ADE, 0xD044036E, 0x97E479BE, 0xAA84500E,
+      0x4834505D, 0x755479ED, 0x32F4033D, 0x0F942A8D, 0xBDB4F69D, 0x80D4DF2D, 0xC774A5FD, 0xFA148C4D,
+      0x78441B9C, 0x4524322C, 0x028448FC, 0x3FE4614C, 0x8DC4BD5C, 0xB0A494EC, 0xF704EE3C, 0xCA64C78C
+   },
+   {
+      0x00000000, 0xCB5CD3A5, 0x4DC8A10B, 0x869472AE, 0x9B914216, 0x50CD91B3, 0xD659E31D, 0x1D0530B8,
+      0xEC53826D, 0x270F51C8, 0xA19B2366, 0x6AC7F0C3, 0x77C2C07B, 0xBC9E13DE, 0x3A0A6170, 0xF156B2D5,
+      0x03D6029B, 0xC88AD13E, 0x4E1EA390, 0x85427035, 0x9847408D, 0x531B9328, 0xD58FE186, 0x1ED33223,
+      0xEF8580F6, 0x24D95353, 0xA24D21FD, 0x6911F258, 0x7414C2E0, 0xBF481145, 0x39DC63EB, 0xF280B04E,
+      0x07AC0536, 0xCCF0D693, 0x4A64A43D, 0x81387798, 0x9C3D4720, 0x57619485, 0xD1F5E62B, 0x1AA9358E,
+      0xEBFF875B, 0x20A354FE, 0xA6372650, 0x6D6BF5F5, 0x706EC54D, 0xBB3216E8, 0x3DA66446, 0xF6FAB7E3,
+      0x047A07AD, 0xCF26D408, 0x49B2A6A6, 0x82EE7503, 0x9FEB45BB, 0x54B7961E, 0xD223E4B0, 0x197F3715,
+      0xE82985C0, 0x23755665, 0xA5E124CB, 0x6EBDF76E, 0x73B8C7D6, 0xB8E41473, 0x3E7066DD, 0xF52CB578,
+      0x0F580A6C, 0xC404D9C9, 0x4290AB67, 0x89CC78C2, 0x94C9487A, 0x5F959BDF, 0xD901E971, 0x125D3AD4,
+      0xE30B8801, 0x28575BA4, 0xAEC3290A, 0x659FFAAF, 0x789ACA17, 0xB3C619B2, 0x35526B1C, 0xFE0EB8B9,
+      0x0C8E08F7, 0xC7D2DB52, 0x4146A9FC, 0x8A1A7A59, 0x971F4AE1, 0x5C439944, 0xDAD7EBEA, 0x118B384F,
+      0xE0DD8A9A, 0x2B81593F, 0xAD152B91, 0x6649F834, 0x7B4CC88C, 0xB0101B29, 0x36846987, 0xFDD8BA22,
+      0x08F40F5A, 0xC3A8DCFF, 0x453CAE51, 0x8E607DF4, 0x93654D4C, 0x58399EE9, 0xDEADEC47, 0x15F13FE2,
+      0xE4A78D37, 0x2FFB5E92, 0xA96F2C3C, 0x6233FF99, 0x7F36CF21, 0xB46A1C84, 0x32FE6E2A, 0xF9A2BD8F,
+      0x0B220DC1, 0xC07EDE64, 0x46EAACCA, 0x8DB67F6F, 0x90B34FD7, 0x5BEF9C72, 0xDD7BEEDC, 0x16273D79,
+      0xE7718FAC, 0x2C2D5C09, 0xAAB92EA7, 0x61E5FD02, 0x7CE0CDBA, 0xB7BC1E1F, 0x31286CB1, 0xFA74BF14,
+      0x1EB014D8, 0xD5ECC77D, 0x5378B5D3, 0x98246676, 0x852156CE, 0x4E7D856B, 0xC8E9F7C5, 0x03B52460,
+      0xF2E396B5, 0x39BF4510, 0xBF2B37BE, 0x7477E41B, 0x6972D4A3, 0xA22E0706, 0x24BA75A8, 0xEFE6A60D,
+      0x1D661643, 0xD63AC5E6, 0x50AEB748, 0x9BF264ED, 0x86F75455, 0x4DAB87F0, 0xCB3FF55E, 0x006326FB,
+      0xF135942E, 0x3A69478B, 0xBCFD3525, 0x77A1E680, 0x6AA4D638, 0xA1F8059D, 0x276C7733, 0xEC30A496,
+      0x191C11EE, 0xD240C24B, 0x54D4B0E5, 0x9F886340, 0x828D53F8, 0x49D1805D, 0xCF45F2F3, 0x04192156,
+      0xF54F9383, 0x3E134026, 0xB8873288, 0x73DBE12D, 0x6EDED195, 0xA5820230, 0x2316709E, 0xE84AA33B,
+      0x1ACA1375, 0xD196C0D0, 0x5702B27E, 0x9C5E61DB, 0x815B5163, 0x4A0782C6, 0xCC93F068, 0x07CF23CD,
+      0xF6999118, 0x3DC542BD, 0xBB513013, 0x700DE3B6, 0x6D08D30E, 0xA65400AB, 0x20C07205, 0xEB9CA1A0,
+      0x11E81EB4, 0xDAB4CD11, 0x5C20BFBF, 0x977C6C1A, 0x8A795CA2, 0x41258F07, 0xC7B1FDA9, 0x0CED2E0C,
+      0xFDBB9CD9, 0x36E74F7C, 0xB0733DD2, 0x7B2FEE77, 0x662ADECF, 0xAD760D6A, 0x2BE27FC4, 0xE0BEAC61,
+      0x123E1C2F, 0xD962CF8A, 0x5FF6BD24, 0x94AA6E81, 0x89AF5E39, 0x42F38D9C, 0xC467FF32, 0x0F3B2C97,
+      0xFE6D9E42, 0x35314DE7, 0xB3A53F49, 0x78F9ECEC, 0x65FCDC54, 0xAEA00FF1, 0x28347D5F, 0xE368AEFA,
+      0x16441B82, 0xDD18C827, 0x5B8CBA89, 0x90D0692C, 0x8DD55994, 0x46898A31, 0xC01DF89F, 0x0B412B3A,
+      0xFA1799EF, 0x314B4A4A, 0xB7DF38E4, 0x7C83EB41, 0x6186DBF9, 0xAADA085C, 0x2C4E7AF2, 0xE712A957,
+      0x15921919, 0xDECECABC, 0x585AB812, 0x93066BB7, 0x8E035B0F, 0x455F88AA, 0xC3CBFA04, 0x089729A1,
+      0xF9C19B74, 0x329D48D1, 0xB4093A7F, 0x7F55E9DA, 0x6250D962, 0xA90C0AC7, 0x2F987869, 0xE4C4ABCC
+   },
+   {
+      0x00000000, 0xA6770BB4, 0x979F1129, 0x31E81A9D, 0xF44F2413, 0x52382FA7, 0x63D0353A, 0xC5A73E8E,
+      0x33EF4E67, 0x959845D3, 0xA4705F4E, 0x020754FA, 0xC7A06A74, 0x61D761C0, 0x503F7B5D, 0xF64870E9,
+      0x67DE9CCE, 0xC1A9977A, 0xF0418DE7, 0x56368653, 0x9391B8DD, 0x35E6B369, 0x040EA9F4, 0xA279A240,
+      0x5431D2A9, 0xF246D91D, 0xC3AEC380, 0x65D9C834, 0xA07EF6BA, 0x0609FD0E, 0x37E1E793, 0x9196EC27,
+      0xCFBD399C, 0x69CA3228, 0x582228B5, 0xFE552301, 0x3BF21D8F, 0x9D85163B, 0xAC6D0CA6, 0x0A1A0712,
+      0xFC5277FB, 0x5A257C4F, 0x6BCD66D2, 0xCDBA6D66, 0x081D53E8, 0xAE6A585C, 0x9F8242C1, 0x39F54975,
+      0xA863A552, 0x0E14AEE6, 0x3FFCB47B, 0x998BBFCF, 0x5C2C8141, 0xFA5B8AF5, 0xCBB39068, 0x6DC49BDC,
+      0x9B8CEB35, 0x3DFBE081, 0x0C13FA1C, 0xAA64F1A8, 0x6FC3CF26, 0xC9B4C492, 0xF85CDE0F, 0x5E2BD5BB,
+      0x440B7579, 0xE27C7ECD, 0xD3946450, 0x75E36FE4, 0xB044516A, 0x16335ADE, 0x27DB4043, 0x81AC4BF7,
+      0x77E43B1E, 0xD19330AA, 0xE07B2A37, 0x460C2183, 0x83AB1F0D, 0x25DC14B9, 0x14340E24, 0xB2430590,
+      0x23D5E9B7, 0x85A2E203, 0xB44AF89E, 0x123DF32A, 0xD79ACDA4, 0x71EDC610, 0x4005DC8D, 0xE672D739,
+      0x103AA7D0, 0xB64DAC64, 0x87A5B6F9, 0x21D2BD4D, 0xE47583C3, 0x42028877, 0x73EA92EA, 0xD59D995E,
+      0x8BB64CE5, 0x2DC14751, 0x1C295DCC, 0xBA5E5678, 0x7FF968F6, 0xD98E6342, 0xE86679DF, 0x4E11726B,
+      0xB8590282, 0x1E2E0936, 0x2FC613AB, 0x89B1181F, 0x4C162691, 0xEA612D25, 0xDB8937B8, 0x7DFE3C0C,
+      0xEC68D02B, 0x4A1FDB9F, 0x7BF7C102, 0xDD80CAB6, 0x1827F438, 0xBE50FF8C, 0x8FB8E511, 0x29CFEEA5,
+      0xDF879E4C, 0x79F095F8, 0x48188F65, 0xEE6F84D1, 0x2BC8BA5F, 0x8DBFB1EB, 0xBC57AB76, 0x1A20A0C2,
+      0x8816EAF2, 0x2E61E146, 0x1F89FBDB, 0xB9FEF06F, 0x7C59CEE1, 0xDA2EC555, 0xEBC6DFC8, 0x4DB1D47C,
+      0xBBF9A495, 0x1D8EAF21, 0x2C66B5BC, 0x8A11BE08, 0x4FB68086, 0xE9C18B32, 0xD82991AF, 0x7E5E9A1B,
+      0xEFC8763C, 0x49BF7D88, 0x78576715, 0xDE206CA1, 0x1B87522F, 0xBDF0599B, 0x8C184306, 0x2A6F48B2,
+      0xDC27385B, 0x7A5033EF, 0x4BB82972, 0xEDCF22C6, 0x28681C48, 0x8E1F17FC, 0xBFF70D61, 0x198006D5,
+      0x47ABD36E, 0xE1DCD8DA, 0xD034C247, 0x7643C9F3, 0xB3E4F77D, 0x1593FCC9, 0x247BE654, 0x820CEDE0,
+      0x74449D09, 0xD23396BD, 0xE3DB8C20, 0x45AC8794, 0x800BB91A, 0x267CB2AE, 0x1794A833, 0xB1E3A387,
+      0x20754FA0, 0x86024414, 0xB7EA5E89, 0x119D553D, 0xD43A6BB3, 0x724D6007, 0x43A57A9A, 0xE5D2712E,
+      0x139A01C7, 0xB5ED0A73, 0x840510EE, 0x22721B5A, 0xE7D525D4, 0x41A22E60, 0x704A34FD, 0xD63D3F49,
+      0xCC1D9F8B, 0x6A6A943F, 0x5B828EA2, 0xFDF58516, 0x3852BB98, 0x9E25B02C, 0xAFCDAAB1, 0x09BAA105,
+      0xFFF2D1EC, 0x5985DA58, 0x686DC0C5, 0xCE1ACB71, 0x0BBDF5FF, 0xADCAFE4B, 0x9C22E4D6, 0x3A55EF62,
+      0xABC30345, 0x0DB408F1, 0x3C5C126C, 0x9A2B19D8, 0x5F8C2756, 0xF9FB2CE2, 0xC813367F, 0x6E643DCB,
+      0x982C4D22, 0x3E5B4696, 0x0FB35C0B, 0xA9C457BF, 0x6C636931, 0xCA146285, 0xFBFC7818, 0x5D8B73AC,
+      0x03A0A617, 0xA5D7ADA3, 0x943FB73E, 0x3248BC8A, 0xF7EF8204, 0x519889B0, 0x6070932D, 0xC6079899,
+      0x304FE870, 0x9638E3C4, 0xA7D0F959, 0x01A7F2ED, 0xC400CC63, 0x6277C7D7, 0x539FDD4A, 0xF5E8D6FE,
+      0x647E3AD9, 0xC209316D, 0xF3E12BF0, 0x55962044, 0x90311ECA, 0x3646157E, 0x07AE0FE3, 0xA1D90457,
+      0x579174BE, 0xF1E67F0A, 0xC00E6597, 0x66796E23, 0xA3DE50AD, 0x05A95B19, 0x34414184, 0x92364A30
+   },
+   {
+      0x00000000, 0xCCAA009E, 0x4225077D, 0x8E8F07E3, 0x844A0EFA, 0x48E00E64, 0xC66F0987, 0x0AC50919,
+      0xD3E51BB5, 0x1F4F1B2B, 0x91C01CC8, 0x5D6A1C56, 0x57AF154F, 0x9B0515D1, 0x158A1232, 0xD92012AC,
+      0x7CBB312B, 0xB01131B5, 0x3E9E3656, 0xF23436C8, 0xF8F13FD1, 0x345B3F4F, 0xBAD438AC, 0x767E3832,
+      0xAF5E2A9E, 0x63F42A00, 0xED7B2DE3, 0x21D12D7D, 0x2B142464, 0xE7BE24FA, 0x69312319, 0xA59B2387,
+      0xF9766256, 0x35DC62C8, 0xBB53652B, 0x77F965B5, 0x7D3C6CAC, 0xB1966C32, 0x3F196BD1, 0xF3B36B4F,
+      0x2A9379E3, 0xE639797D, 0x68B67E9E, 0xA41C7E00, 0xAED97719, 0x62737787, 0xECFC7064, 0x205670FA,
+      0x85CD537D, 0x496753E3, 0xC7E85400, 0x0B42549E, 0x01875D87, 0xCD2D5D19, 0x43A25AFA, 0x8F085A64,
+      0x562848C8, 0x9A824856, 0x140D4FB5, 0xD8A74F2B, 0xD2624632, 0x1EC846AC, 0x9047414F, 0x5CED41D1,
+      0x299DC2ED, 0xE537C273, 0x6BB8C590, 0xA712C50E, 0xADD7CC17, 0x617DCC89, 0xEFF2CB6A, 0x2358CBF4,
+      0xFA78D958, 0x36D2D9C6, 0xB85DDE25, 0x74F7DEBB, 0x7E32D7A2, 0xB298D73C, 0x3C17D0DF, 0xF0BDD041,
+      0x5526F3C6, 0x998CF358, 0x1703F4BB, 0xDBA9F425, 0xD16CFD3C, 0x1DC6FDA2, 0x9349FA41, 0x5FE3FADF,
+      0x86C3E873, 0x4A69E8ED, 0xC4E6EF0E, 0x084CEF90, 0x0289E689, 0xCE23E617, 0x40ACE1F4, 0x8C06E16A,
+      0xD0EBA0BB, 0x1C41A025, 0x92CEA7C6, 0x5E64A758, 0x54A1AE41, 0x980BAEDF, 0x1684A93C, 0xDA2EA9A2,
+      0x030EBB0E, 0xCFA4BB90, 0x412BBC73, 0x8D81BCED, 0x8744B5F4, 0x4BEEB56A, 0xC561B289, 0x09CBB217,
+      0xAC509190, 0x60FA910E, 0xEE7596ED, 0x22DF9673, 0x281A9F6A, 0xE4B09FF4, 0x6A3F9817, 0xA6959889,
+      0x7FB58A25, 0xB31F8ABB, 0x3D908D58, 0xF13A8DC6, 0xFBFF84DF, 0x37558441, 0xB9DA83A2, 0x7570833C,
+      0x533B85DA, 0x9F918544, 0x111E82A7, 0xDDB48239, 0xD7718B20, 0x1BDB8BBE, 0x95548C5D, 0x59FE8CC3,
+      0x80DE9E6F, 0x4C749EF1, 0xC2FB9912, 0x0E51998C, 0x04949095, 0xC83E900B, 0x46B197E8, 0x8A1B9776,
+      0x2F80B4F1, 0xE32AB46F, 0x6DA5B38C, 0xA10FB312, 0xABCABA0B, 0x6760BA95, 0xE9EFBD76, 0x2545BDE8,
+      0xFC65AF44, 0x30CFAFDA, 0xBE40A839, 0x72EAA8A7, 0x782FA1BE, 0xB485A120, 0x3A0AA6C3, 0xF6A0A65D,
+      0xAA4DE78C, 0x66E7E712, 0xE868E0F1, 0x24C2E06F, 0x2E07E976, 0xE2ADE9E8, 0x6C22EE0B, 0xA088EE95,
+      0x79A8FC39, 0xB502FCA7, 0x3B8DFB44, 0xF727FBDA, 0xFDE2F2C3, 0x3148F25D, 0xBFC7F5BE, 0x736DF520,
+      0xD6F6D6A7, 0x1A5CD639, 0x94D3D1DA, 0x5879D144, 0x52BCD85D, 0x9E16D8C3, 0x1099DF20, 0xDC33DFBE,
+      0x0513CD12, 0xC9B9CD8C, 0x4736CA6F, 0x8B9CCAF1, 0x8159C3E8, 0x4DF3C376, 0xC37CC495, 0x0FD6C40B,
+      0x7AA64737, 0xB60C47A9, 0x3883404A, 0xF42940D4, 0xFEEC49CD, 0x32464953, 0xBCC94EB0, 0x70634E2E,
+      0xA9435C82, 0x65E95C1C, 0xEB665BFF, 0x27CC5B61, 0x2D095278, 0xE1A352E6, 0x6F2C5505, 0xA386559B,
+      0x061D761C, 0xCAB77682, 0x44387161, 0x889271FF, 0x825778E6, 0x4EFD7878, 0xC0727F9B, 0x0CD87F05,
+      0xD5F86DA9, 0x19526D37, 0x97DD6AD4, 0x5B776A4A, 0x51B26353, 0x9D1863CD, 0x1397642E, 0xDF3D64B0,
+      0x83D02561, 0x4F7A25FF, 0xC1F5221C, 0x0D5F2282, 0x079A2B9B, 0xCB302B05, 0x45BF2CE6, 0x89152C78,
+      0x50353ED4, 0x9C9F3E4A, 0x121039A9, 0xDEBA3937, 0xD47F302E, 0x18D530B0, 0x965A3753, 0x5AF037CD,
+      0xFF6B144A, 0x33C114D4, 0xBD4E1337, 0x71E413A9, 0x7B211AB0, 0xB78B1A2E, 0x39041DCD, 0xF5AE1D53,
+      0x2C8E0FFF, 0xE0240F61, 0x6EAB0882, 0xA201081C, 0xA8C40105, 0x646E019B, 0xEAE10678, 0x264B06E6
+   }
+};
+
+// slice-by-8: crc is the running crc register, before the final inversion
+static unsigned int stbiw__crc32_update(unsigned int crc, const unsigned char *buffer, int len)
+{
+   while (len >= 8) {
+      unsigned int lo = crc ^ (buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((unsigned int) buffer[3] << 24));
+      unsigned int hi = buffer[4] | (buffer[5] << 8) | (buffer[6] << 16) | ((unsigned int) buffer[7] << 24);
+      crc = stbiw__crc_table[7][lo & 0xff] ^ stbiw__crc_table[6][(lo >> 8) & 0xff] ^
+            stbiw__crc_table[5][(lo >> 16) & 0xff] ^ stbiw__crc_table[4][lo >> 24] ^
+            stbiw__crc_table[3][hi & 0xff] ^ stbiw__crc_table[2][(hi >> 8) & 0xff] ^
+            stbiw__crc_table[1][(hi >> 16) & 0xff] ^ stbiw__crc_table[0][hi >> 24];
+      buffer += 8;
+      len -= 8;
+   }
+   while (len-- > 0)
+      crc = (crc >> 8) ^ stbiw__crc_table[0][(crc ^ *buffer++) & 0xff];
+   return crc;
+}
+
+#ifdef STBIW_PCLMUL
+// folds 128 bits of crc state forward over 16 bytes (k = R4R3) or, with 4 states, over 64 bytes (k = R2R1)
+#define stbiw__crc_fold(x,k) _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11))
+
+// carry-less multiply folding of a multiple of 16 bytes, at least 64. the 16 bytes of state left at
+// the end have the same crc as everything folded into them, which the table then finishes.
+STBIW_TARGET_PCLMUL static unsigned int stbiw__crc32_pclmul(unsigned int crc, const unsigned char *buffer, int len)
+{
+   const __m128i r2r1 = _mm_set_epi32(0x00000001, 0xc6e41596, 0x00000001, 0x54442bd4);
+   const __m128i r4r3 = _mm_set_epi32(0x00000000, 0xccaa009e, 0x00000001, 0x751997d0);
+   unsigned char state[16];
+   __m128i x0 = _mm_xor_si128(_mm_loadu_si128((__m128i *) buffer), _mm_cvtsi32_si128((int) crc));
+   __m128i x1 = _mm_loadu_si128((__m128i *) (buffer+16));
+   __m128i x2 = _mm_loadu_si128((__m128i *) (buffer+32));
+   __m128i x3 = _mm_loadu_si128((__m128i *) (buffer+48));
+   buffer += 64;
+   len -= 64;
+   for (; len >= 64; buffer += 64, len -= 64) {
+      x0 = _mm_xor_si128(stbiw__crc_fold(x0, r2r1), _mm_loadu_si128((__m128i *) buffer));
+      x1 = _mm_xor_si128(stbiw__crc_fold(x1, r2r1), _mm_loadu_si128((__m128i *) (buffer+16)));
+      x2 = _mm_xor_si128(stbiw__crc_fold(x2, r2r1), _mm_loadu_si128((__m128i *) (buffer+32)));
+      x3 = _mm_xor_si128(stbiw__crc_fold(x3, r2r1), _mm_loadu_si128((__m128i *) (buffer+48)));
+   }
+   x0 = _mm_xor_si128(stbiw__crc_fold(x0, r4r3), x1);
+   x0 = _mm_xor_si128(stbiw__crc_fold(x0, r4r3), x2);
+   x0 = _mm_xor_si128(stbiw__crc_fold(x0, r4r3), x3);
+   for (; len >= 16; buffer += 16, len -= 16)
+      x0 = _mm_xor_si128(stbiw__crc_fold(x0, r4r3), _mm_loadu_si128((__m128i *) buffer));
+   _mm_storeu_si128((__m128i *) state, x0);
+   return stbiw__crc32_update(0, state, 16);
+}
+#endif // STBIW_PCLMUL
+#endif // STBIW_CRC32
 
+static unsigned int stbiw__crc32(unsigned char *buffer, int len)
+{
+#ifdef STBIW_CRC32
+    return STBIW_CRC32(buffer, len);
+#else
    unsigned int crc = ~0u;
-   int i;
-   for (i=0; i < len; ++i)
-      crc = (crc >> 8) ^ crc_table[buffer[i] ^ (crc & 0xff)];
-   return ~crc;
+#ifdef STBIW_PCLMUL
+   if (len >= 64 && stbiw__pclmul_available()) {
+      crc = stbiw__crc32_pclmul(crc, buffer, len & ~15);
+      buffer += len & ~15;
+      len &= 15;
+   }
+#endif
+   return ~stbiw__crc32_update(crc, buffer, len);
 #endif
 }
 
@@ -1038,16 +1848,17 @@ static unsigned char stbiw__paeth(int a, int b, int c)
    return STBIW_UCHAR(c);
 }
 
+#ifndef STBIW_SSE2
 // @OPTIMIZE: provide an option that always forces left-predict or paeth predict
-static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int width, int height, int y, int n, int filter_type, signed char *line_buffer)
+static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int width, int height, int y, int n, int filter_type, int flip, signed char *line_buffer)
 {
    static int mapping[] = { 0,1,2,3,4 };
    static int firstmap[] = { 0,1,0,5,6 };
    int *mymap = (y != 0) ? mapping : firstmap;
    int i;
    int type = mymap[filter_type];
-   unsigned char *z = pixels + stride_bytes * (stbi__flip_vertically_on_write ? height-1-y : y);
-   int signed_stride = stbi__flip_vertically_on_write ? -stride_bytes : stride_bytes;
+   unsigned char *z = pixels + stride_bytes * (flip ? height-1-y : y);
+   int signed_stride = flip ? -stride_bytes : stride_bytes;
     
    if (type==0) {
       memcpy(line_buffer, z, width*n);
@@ -1074,66 +1885,296 @@ static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int
       case 6: for (i=n; i < width*n; ++i) line_buffer[i] = z[i] - stbiw__paeth(z[i-n], 0,0); break;
    }
 }
+#endif // STBIW_SSE2
 
-STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+#ifdef STBIW_SSE2
+static unsigned char stbiw__png_filter_byte(int filter_type, int x, int a, int b, int c)
 {
-   int force_filter = stbi_write_force_png_filter;
-   int ctype[5] = { -1, 0, 4, 2, 6 };
-   unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
-   unsigned char *out,*o, *filt, *zlib;
-   signed char *line_buffer;
-   int j,zlen;
+   switch (filter_type) {
+      case 1: return STBIW_UCHAR(x - a);
+      case 2: return STBIW_UCHAR(x - b);
+      case 3: return STBIW_UCHAR(x - ((a + b) >> 1));
+      case 4: return STBIW_UCHAR(x - stbiw__paeth(a, b, c));
+      default: return STBIW_UCHAR(x);
+   }
+}
 
-   if (stride_bytes == 0)
-      stride_bytes = x * n;
+// paeth predictor of 8 pixels in 16 bit lanes; pa = |p-a| = |b-c|, pb = |p-b| = |a-c|, pc = |p-c| = |(b-c)+(a-c)|
+static __m128i stbiw__paeth16_sse2(__m128i a, __m128i b, __m128i c)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i pa = _mm_sub_epi16(b, c), pb = _mm_sub_epi16(a, c), pc = _mm_add_epi16(pa, pb);
+   __m128i not_a, use_c, bc;
+   pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+   pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+   pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+   not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+   use_c = _mm_cmpgt_epi16(pb, pc);
+   bc = _mm_or_si128(_mm_and_si128(use_c, c), _mm_andnot_si128(use_c, b));
+   return _mm_or_si128(_mm_and_si128(not_a, bc), _mm_andnot_si128(not_a, a));
+}
 
-   if (force_filter >= 5) {
-      force_filter = -1;
+// filters 16 bytes x, given the bytes a to their left, b above and c above left
+static __m128i stbiw__png_filter_sse2(int filter_type, __m128i x, __m128i a, __m128i b, __m128i c)
+{
+   __m128i zero = _mm_setzero_si128();
+   switch (filter_type) {
+      case 1: return _mm_sub_epi8(x, a);
+      case 2: return _mm_sub_epi8(x, b);
+      case 3: // avg_epu8 rounds up, the average filter rounds down
+         return _mm_sub_epi8(x, _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1))));
+      case 4:
+         return _mm_sub_epi8(x, _mm_packus_epi16(
+            stbiw__paeth16_sse2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero)),
+            stbiw__paeth16_sse2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero))));
+      default: return x;
    }
+}
+
+// sum of abs((signed char) v) over v, for all 5 filters of the row z with the row prior above it
+static void stbiw__png_filter_costs_sse2(unsigned char *z, unsigned char *prior, int len, int n, int *est)
+{
+   __m128i zero = _mm_setzero_si128(), sum[5];
+   int i, f;
+   for (f=0; f < 5; ++f) {
+      sum[f] = zero;
+      est[f] = 0;
+   }
+   // the first pixel has nothing to its left
+   for (i=0; i < n && i < len; ++i)
+      for (f=0; f < 5; ++f)
+         est[f] += abs((signed char) stbiw__png_filter_byte(f, z[i], 0, prior[i], 0));
+   for (; i+16 <= len; i += 16) {
+      __m128i x = _mm_loadu_si128((__m128i *) (z+i)), a = _mm_loadu_si128((__m128i *) (z+i-n));
+      __m128i b = _mm_loadu_si128((__m128i *) (prior+i)), c = _mm_loadu_si128((__m128i *) (prior+i-n));
+      for (f=0; f < 5; ++f) {
+         __m128i v = stbiw__png_filter_sse2(f, x, a, b, c);
+         sum[f] = _mm_add_epi64(sum[f], _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero));
+      }
+   }
+   for (; i < len; ++i)
+      for (f=0; f < 5; ++f)
+         est[f] += abs((signed char) stbiw__png_filter_byte(f, z[i], z[i-n], prior[i], prior[i-n]));
+   for (f=0; f < 5; ++f)
+      est[f] += _mm_cvtsi128_si32(sum[f]) + _mm_cvtsi128_si32(_mm_srli_si128(sum[f], 8));
+}
+
+static void stbiw__png_filter_line_sse2(unsigned char *z, unsigned char *prior, int len, int n, int filter_type, unsigned char *out)
+{
+   int i;
+   for (i=0; i < n && i < len; ++i)
+      out[i] = stbiw__png_filter_byte(filter_type, z[i], 0, prior[i], 0);
+   for (; i+16 <= len; i += 16) {
+      __m128i x = _mm_loadu_si128((__m128i *) (z+i)), a = _mm_loadu_si128((__m128i *) (z+i-n));
+      __m128i b = _mm_loadu_si128((__m128i *) (prior+i)), c = _mm_loadu_si128((__m128i *) (prior+i-n));
+      _mm_storeu_si128((__m128i *) (out+i), stbiw__png_filter_sse2(filter_type, x, a, b, c));
+   }
+   for (; i < len; ++i)
+      out[i] = stbiw__png_filter_byte(filter_type, z[i], z[i-n], prior[i], prior[i-n]);
+}
+#endif // STBIW_SSE2
+
+static void stbiw__png_filter_row(unsigned char *pixels, int stride_bytes, int x, int y, int n, int force_filter, int flip, int j, signed char *line_buffer, unsigned char *filt_row)
+{
+   int filter_type;
+#ifdef STBIW_SSE2
+   {
+      // all 5 filters are scored in one pass. the first row is filtered against a row of zeros, which
+      // gives the same bytes as the first row mapping stbiw__encode_png_line uses.
+      unsigned char *z = pixels + stride_bytes * (flip ? y-1-j : j);
+      unsigned char *prior = (unsigned char *) line_buffer;
+      if (j != 0)
+         prior = z - (flip ? -stride_bytes : stride_bytes);
+      else
+         memset(line_buffer, 0, x*n);
 
-   filt = (unsigned char *) STBIW_MALLOC((x*n+1) * y); if (!filt) return 0;
-   line_buffer = (signed char *) STBIW_MALLOC(x * n); if (!line_buffer) { STBIW_FREE(filt); return 0; }
-   for (j=0; j < y; ++j) {
-      int filter_type;
       if (force_filter > -1) {
          filter_type = force_filter;
-         stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, force_filter, line_buffer);
-      } else { // Estimate the best filter by running through all of them:
-         int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
-         for (filter_type = 0; filter_type < 5; filter_type++) {
-            stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, filter_type, line_buffer);
-
-            // Estimate the entropy of the line using this filter; the less, the better.
-            est = 0;
-            for (i = 0; i < x*n; ++i) {
-               est += abs((signed char) line_buffer[i]);
-            }
-            if (est < best_filter_val) {
-               best_filter_val = est;
-               best_filter = filter_type;
+      } else {
+         int est[5], best_filter_val = 0x7fffffff, f;
+         stbiw__png_filter_costs_sse2(z, prior, x*n, n, est);
+         for (filter_type = 0, f = 0; f < 5; ++f) {
+            if (est[f] < best_filter_val) {
+               best_filter_val = est[f];
+               filter_type = f;
             }
          }
-         if (filter_type != best_filter) {  // If the last iteration already got us the best filter, don't redo it
-            stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, best_filter, line_buffer);
-            filter_type = best_filter;
+      }
+      filt_row[0] = (unsigned char) filter_type;
+      stbiw__png_filter_line_sse2(z, prior, x*n, n, filter_type, filt_row+1);
+      return;
+   }
+#else
+   if (force_filter > -1) {
+      filter_type = force_filter;
+      stbiw__encode_png_line(pixels, stride_bytes, x, y, j, n, force_filter, flip, line_buffer);
+   } else { // Estimate the best filter by running through all of them:
+      int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
+      for (filter_type = 0; filter_type < 5; filter_type++) {
+         stbiw__encode_png_line(pixels, stride_bytes, x, y, j, n, filter_type, flip, line_buffer);
+
+         // Estimate the entropy of the line using this filter; the less, the better.
+         est = 0;
+         for (i = 0; i < x*n; ++i) {
+            est += abs((signed char) line_buffer[i]);
          }
+         if (est < best_filter_val) {
+            best_filter_val = est;
+            best_filter = filter_type;
+         }
+      }
+      if (filter_type != best_filter) {  // If the last iteration already got us the best filter, don't redo it
+         stbiw__encode_png_line(pixels, stride_bytes, x, y, j, n, best_filter, flip, line_buffer);
+         filter_type = best_filter;
       }
-      // when we get here, filter_type contains the filter type, and line_buffer contains the data
-      filt[j*(x*n+1)] = (unsigned char) filter_type;
-      STBIW_MEMMOVE(filt+j*(x*n+1)+1, line_buffer, x*n);
    }
-   STBIW_FREE(line_buffer);
-   zlib = stbi_zlib_compress(filt, y*( x*n+1), &zlen, stbi_write_png_compression_level);
-   STBIW_FREE(filt);
+   // when we get here, filter_type contains the filter type, and line_buffer contains the data
+   filt_row[0] = (unsigned char) filter_type;
+   STBIW_MEMMOVE(filt_row+1, line_buffer, x*n);
+#endif // STBIW_SSE2
+}
+
+// a PNG being encoded a band of rows at a time, by STBIW_PARALLEL_FOR jobs
+typedef struct
+{
+   const stbi_write_png_options *options;
+   unsigned char *pixels;
+   int stride_bytes, x, y, n, force_filter;
+   int rows_per_band, band_count;
+   unsigned char *filt;
+   signed char *line_buffers; // one row per band
+   unsigned char **band_zlib;
+   int *band_len;
+   unsigned int *band_adler;
+} stbiw__png_bands;
+
+static void stbiw__png_band_range(stbiw__png_bands *b, int band, int *start, int *end)
+{
+   int row_bytes = b->x*b->n+1;
+   int end_row = (band+1)*b->rows_per_band;
+   *start = band * b->rows_per_band * row_bytes;
+   *end = (end_row < b->y ? end_row : b->y) * row_bytes;
+}
+
+static void stbiw__png_filter_band(void *context, int band)
+{
+   stbiw__png_bands *b = (stbiw__png_bands *) context;
+   int row_bytes = b->x*b->n+1;
+   int j, start, end;
+   stbiw__png_band_range(b, band, &start, &end);
+   for (j=start/row_bytes; j < end/row_bytes; ++j)
+      stbiw__png_filter_row(b->pixels, b->stride_bytes, b->x, b->y, b->n, b->force_filter, b->options->flip_vertically, j, b->line_buffers + band*b->x*b->n, b->filt + j*row_bytes);
+}
+
+#ifndef STBIW_ZLIB_COMPRESS
+static void stbiw__png_compress_band(void *context, int band)
+{
+   stbiw__png_bands *b = (stbiw__png_bands *) context;
+   int start, end;
+   stbiw__png_band_range(b, band, &start, &end);
+   b->band_len[band] = 0;
+   b->band_zlib[band] = stbiw__zlib_compress_band(b->options, b->filt, start, end, b->options->compression_level, band == b->band_count-1, &b->band_len[band]);
+   b->band_adler[band] = stbiw__adler32(1, b->filt+start, end-start);
+}
+#endif // STBIW_ZLIB_COMPRESS
+
+STBIWDEF void stbi_write_png_default_options(stbi_write_png_options *options)
+{
+   options->compression_level = stbi_write_png_compression_level;
+   options->force_filter = stbi_write_force_png_filter;
+   options->flip_vertically = stbi__flip_vertically_on_write;
+   options->alloc_func = NULL;
+   options->free_func = NULL;
+   options->alloc_user = NULL;
+}
+
+// Filters and compresses an image into a zlib stream. The stream starts 'before' bytes into the returned buffer
+// and is followed by 'after' more bytes, so the caller can wrap it in chunks without copying it.
+static unsigned char *stbiw__png_zlib(const stbi_write_png_options *options, const unsigned char *pixels, int stride_bytes, int x, int y, int n, int before, int after, int *zlen)
+{
+   int force_filter = options->force_filter;
+   unsigned char *out, *filt;
+   stbiw__png_bands bands;
+#ifdef STBIW_ZLIB_COMPRESS
+   unsigned char *zlib;
+#else
+   unsigned char *o;
+   int band, failed = 0;
+   unsigned int adler = 1;
+#endif
+
+   if (force_filter >= 5) {
+      force_filter = -1;
+   }
+
+   bands.options = options;
+   bands.pixels = (unsigned char *) pixels;
+   bands.stride_bytes = stride_bytes;
+   bands.x = x;
+   bands.y = y;
+   bands.n = n;
+   bands.force_filter = force_filter;
+   bands.rows_per_band = STBIW_PNG_BAND_BYTES / (x*n+1);
+   if (bands.rows_per_band < 1) bands.rows_per_band = 1;
+   bands.band_count = (y + bands.rows_per_band-1) / bands.rows_per_band;
+   if (bands.band_count < 1) bands.band_count = 1;
+
+   filt = (unsigned char *) stbiw__png_alloc(options, (x*n+1) * y); if (!filt) return 0;
+   bands.filt = filt;
+   bands.line_buffers = (signed char *) stbiw__png_alloc(options, x * n * bands.band_count); if (!bands.line_buffers) { stbiw__png_free(options, filt); return 0; }
+   STBIW_PARALLEL_FOR(bands.band_count, stbiw__png_filter_band, &bands);
+   stbiw__png_free(options, bands.line_buffers);
+
+#ifdef STBIW_ZLIB_COMPRESS
+   zlib = stbi_zlib_compress(filt, y*( x*n+1), zlen, options->compression_level);
+   stbiw__png_free(options, filt);
    if (!zlib) return 0;
 
-   // each tag requires 12 bytes of overhead
-   out = (unsigned char *) STBIW_MALLOC(8 + 12+13 + 12+zlen + 12);
-   if (!out) return 0;
-   *out_len = 8 + 12+13 + 12+zlen + 12;
+   out = (unsigned char *) stbiw__png_alloc(options, before + *zlen + after);
+   if (out)
+      STBIW_MEMMOVE(out + before, zlib, *zlen);
+   STBIW_FREE(zlib);
+   return out;
+#else
+   // compress the bands separately; they are joined into one zlib stream below
+   bands.band_zlib = (unsigned char **) stbiw__png_alloc(options, bands.band_count * (sizeof(unsigned char *) + sizeof(int) + sizeof(unsigned int)));
+   if (!bands.band_zlib) { stbiw__png_free(options, filt); return 0; }
+   bands.band_len = (int *) (bands.band_zlib + bands.band_count);
+   bands.band_adler = (unsigned int *) (bands.band_len + bands.band_count);
+   STBIW_PARALLEL_FOR(bands.band_count, stbiw__png_compress_band, &bands);
+   stbiw__png_free(options, filt);
+
+   *zlen = 2 + 4;
+   for (band=0; band < bands.band_count; ++band) {
+      int start, end;
+      if (!bands.band_zlib[band]) failed = 1;
+      *zlen += bands.band_len[band];
+      stbiw__png_band_range(&bands, band, &start, &end);
+      adler = band ? stbiw__adler32_combine(adler, bands.band_adler[band], end-start) : bands.band_adler[band];
+   }
 
-   o=out;
-   STBIW_MEMMOVE(o,sig,8); o+= 8;
+   out = failed ? NULL : (unsigned char *) stbiw__png_alloc(options, before + *zlen + after);
+   if (out) {
+      o = out + before;
+      *o++ = 0x78;   // DEFLATE 32K window
+      *o++ = 0x5e;   // FLEVEL = 1
+      for (band=0; band < bands.band_count; ++band) {
+         STBIW_MEMMOVE(o, bands.band_zlib[band], bands.band_len[band]);
+         o += bands.band_len[band];
+      }
+      stbiw__wp32(o, adler);
+   }
+   for (band=0; band < bands.band_count; ++band)
+      stbiw__png_free(options, bands.band_zlib[band]);
+   stbiw__png_free(options, bands.band_zlib);
+   return out;
+#endif // STBIW_ZLIB_COMPRESS
+}
+
+static void stbiw__png_ihdr(unsigned char **data, int x, int y, int n)
+{
+   int ctype[5] = { -1, 0, 4, 2, 6 };
+   unsigned char *o = *data;
    stbiw__wp32(o, 13); // header length
    stbiw__wptag(o, "IHDR");
    stbiw__wp32(o, x);
@@ -1144,12 +2185,30 @@ STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int s
    *o++ = 0;
    *o++ = 0;
    stbiw__wpcrc(&o,13);
+   *data = o;
+}
+
+STBIWDEF unsigned char *stbi_write_png_to_mem_ex(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len, const stbi_write_png_options *options)
+{
+   unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
+   unsigned char *out,*o;
+   int zlen;
+
+   if (stride_bytes == 0)
+      stride_bytes = x * n;
+
+   // each tag requires 12 bytes of overhead
+   out = stbiw__png_zlib(options, pixels, stride_bytes, x, y, n, 8 + 12+13 + 8, 4 + 12, &zlen);
+   if (!out) return 0;
+   *out_len = 8 + 12+13 + 12+zlen + 12;
+
+   o=out;
+   STBIW_MEMMOVE(o,sig,8); o+= 8;
+   stbiw__png_ihdr(&o, x, y, n);
 
    stbiw__wp32(o, zlen);
    stbiw__wptag(o, "IDAT");
-   STBIW_MEMMOVE(o, zlib, zlen);
    o += zlen;
-   STBIW_FREE(zlib);
    stbiw__wpcrc(&o, zlen);
 
    stbiw__wp32(o,0);
@@ -1161,33 +2220,234 @@ STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int s
    return out;
 }
 
+STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+{
+   stbi_write_png_options options;
+   stbi_write_png_default_options(&options);
+   return stbi_write_png_to_mem_ex(pixels, stride_bytes, x, y, n, out_len, &options);
+}
+
 #ifndef STBI_WRITE_NO_STDIO
-STBIWDEF int stbi_write_png(char const *filename, int x, int y, int comp, const void *data, int stride_bytes)
+STBIWDEF int stbi_write_png_ex(char const *filename, int x, int y, int comp, const void *data, int stride_bytes, const stbi_write_png_options *options)
 {
    FILE *f;
    int len;
-   unsigned char *png = stbi_write_png_to_mem((const unsigned char *) data, stride_bytes, x, y, comp, &len);
+   unsigned char *png = stbi_write_png_to_mem_ex((const unsigned char *) data, stride_bytes, x, y, comp, &len, options);
    if (png == NULL) return 0;
 
    f = stbiw__fopen(filename, "wb");
-   if (!f) { STBIW_FREE(png); return 0; }
+   if (!f) { stbiw__png_free(options, png); return 0; }
    fwrite(png, 1, len, f);
    fclose(f);
-   STBIW_FREE(png);
+   stbiw__png_free(options, png);
    return 1;
 }
+
+STBIWDEF int stbi_write_png(char const *filename, int x, int y, int comp, const void *data, int stride_bytes)
+{
+   stbi_write_png_options options;
+   stbi_write_png_default_options(&options);
+   return stbi_write_png_ex(filename, x, y, comp, data, stride_bytes, &options);
+}
 #endif
 
-STBIWDEF int stbi_write_png_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_bytes)
+STBIWDEF int stbi_write_png_to_func_ex(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_bytes, const stbi_write_png_options *options)
 {
    int len;
-   unsigned char *png = stbi_write_png_to_mem((const unsigned char *) data, stride_bytes, x, y, comp, &len);
+   unsigned char *png = stbi_write_png_to_mem_ex((const unsigned char *) data, stride_bytes, x, y, comp, &len, options);
    if (png == NULL) return 0;
    func(context, png, len);
-   STBIW_FREE(png);
+   stbiw__png_free(options, png);
    return 1;
 }
 
+STBIWDEF int stbi_write_png_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_bytes)
+{
+   stbi_write_png_options options;
+   stbi_write_png_default_options(&options);
+   return stbi_write_png_to_func_ex(func, context, x, y, comp, data, stride_bytes, &options);
+}
+
+
+// an animated PNG being encoded a frame at a time, by STBIW_PARALLEL_FOR jobs
+typedef struct
+{
+   const stbi_write_png_options *options;
+   const stbi_write_apng_frame *frames;
+   int stride_bytes, x, y, n;
+   unsigned char **frame_data; // the fcTL chunk and image data chunk of each frame
+   int *frame_len;
+} stbiw__apng;
+
+// finds the columns [*x0,*x1) and rows [*y0,*y1) holding every pixel that differs between a and b, or an empty
+// rectangle if none do
+static void stbiw__apng_changed_rect(const unsigned char *a, const unsigned char *b, int stride_bytes, int x, int y, int n, int *x0, int *y0, int *x1, int *y1)
+{
+   int i, j;
+   *x0 = x; *y0 = y; *x1 = 0; *y1 = 0;
+   for (j=0; j < y; ++j) {
+      const unsigned char *ra = a + j*stride_bytes, *rb = b + j*stride_bytes;
+      if (memcmp(ra, rb, x*n) == 0)
+         continue;
+      if (*y0 > j) *y0 = j;
+      *y1 = j+1;
+      // only the pixels outside the rectangle so far can widen it
+      for (i=0; i < *x0 && memcmp(ra+i*n, rb+i*n, n) == 0; ++i)
+         ;
+      *x0 = i;
+      for (i=x; i > *x1 && memcmp(ra+(i-1)*n, rb+(i-1)*n, n) == 0; --i)
+         ;
+      *x1 = i;
+   }
+}
+
+static void stbiw__apng_encode_frame(void *context, int frame)
+{
+   stbiw__apng *a = (stbiw__apng *) context;
+   const stbi_write_apng_frame *f = &a->frames[frame];
+   const unsigned char *pixels = (const unsigned char *) f->pixels;
+   // the first frame is the default image in IDAT, later ones are fdAT chunks with a sequence number
+   int before = 12+26 + 8 + (frame ? 4 : 0);
+   int seq = frame ? 2*frame-1 : 0;
+   int x0 = 0, y0 = 0, x1 = a->x, y1 = a->y, zlen;
+   unsigned char *out, *o;
+
+   if (frame && f->w > 0 && f->h > 0) {
+      STBIW_ASSERT(f->x >= 0 && f->y >= 0 && f->x + f->w <= a->x && f->y + f->h <= a->y);
+      x0 = f->x;
+      y0 = f->y;
+      x1 = f->x + f->w;
+      y1 = f->y + f->h;
+   } else if (frame) {
+      stbiw__apng_changed_rect((const unsigned char *) a->frames[frame-1].pixels, pixels, a->stride_bytes, a->x, a->y, a->n, &x0, &y0, &x1, &y1);
+      if (x1 <= x0) {
+         // a frame has at least one pixel, so an unchanged frame rewrites the top left one
+         x0 = y0 = 0;
+         x1 = y1 = 1;
+      }
+   }
+
+   out = stbiw__png_zlib(a->options, pixels + y0*a->stride_bytes + x0*a->n, a->stride_bytes, x1-x0, y1-y0, a->n, before, 4, &zlen);
+   a->frame_data[frame] = out;
+   if (!out) return;
+   a->frame_len[frame] = before + zlen + 4;
+
+   o = out;
+   stbiw__wp32(o, 26);
+   stbiw__wptag(o, "fcTL");
+   stbiw__wp32(o, seq);
+   stbiw__wp32(o, x1-x0);
+   stbiw__wp32(o, y1-y0);
+   stbiw__wp32(o, x0);
+   stbiw__wp32(o, a->options->flip_vertically ? a->y-y1 : y0);
+   *o++ = STBIW_UCHAR(f->delay_num >> 8);
+   *o++ = STBIW_UCHAR(f->delay_num);
+   *o++ = STBIW_UCHAR(f->delay_den >> 8);
+   *o++ = STBIW_UCHAR(f->delay_den);
+   *o++ = 0; // APNG_DISPOSE_OP_NONE
+   *o++ = 0; // APNG_BLEND_OP_SOURCE
+   stbiw__wpcrc(&o, 26);
+
+   if (frame) {
+      stbiw__wp32(o, zlen+4);
+      stbiw__wptag(o, "fdAT");
+      stbiw__wp32(o, seq+1);
+      o += zlen;
+      stbiw__wpcrc(&o, zlen+4);
+   } else {
+      stbiw__wp32(o, zlen);
+      stbiw__wptag(o, "IDAT");
+      o += zlen;
+      stbiw__wpcrc(&o, zlen);
+   }
+   STBIW_ASSERT(o == out + a->frame_len[frame]);
+}
+
+STBIWDEF unsigned char *stbi_write_apng_to_mem(const stbi_write_apng_frame *frames, int frame_count, int stride_bytes, int x, int y, int n, int *out_len, const stbi_write_png_options *options)
+{
+   unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
+   unsigned char *out = NULL, *o;
+   stbiw__apng a;
+   int frame, len = 8 + 12+13 + 12+8 + 12;
+
+   if (frame_count < 1)
+      return 0;
+   if (stride_bytes == 0)
+      stride_bytes = x * n;
+
+   a.options = options;
+   a.frames = frames;
+   a.stride_bytes = stride_bytes;
+   a.x = x;
+   a.y = y;
+   a.n = n;
+   a.frame_data = (unsigned char **) stbiw__png_alloc(options, frame_count * (sizeof(unsigned char *) + sizeof(int)));
+   if (!a.frame_data) return 0;
+   a.frame_len = (int *) (a.frame_data + frame_count);
+   STBIW_PARALLEL_FOR(frame_count, stbiw__apng_encode_frame, &a);
+
+   for (frame=0; frame < frame_count; ++frame) {
+      if (!a.frame_data[frame]) { len = -1; break; }
+      len += a.frame_len[frame];
+   }
+   if (len > 0)
+      out = (unsigned char *) stbiw__png_alloc(options, len);
+
+   if (out) {
+      *out_len = len;
+      o = out;
+      STBIW_MEMMOVE(o,sig,8); o+= 8;
+      stbiw__png_ihdr(&o, x, y, n);
+
+      stbiw__wp32(o, 8);
+      stbiw__wptag(o, "acTL");
+      stbiw__wp32(o, frame_count);
+      stbiw__wp32(o, 0); // loop forever
+      stbiw__wpcrc(&o, 8);
+
+      for (frame=0; frame < frame_count; ++frame) {
+         STBIW_MEMMOVE(o, a.frame_data[frame], a.frame_len[frame]);
+         o += a.frame_len[frame];
+      }
+
+      stbiw__wp32(o,0);
+      stbiw__wptag(o, "IEND");
+      stbiw__wpcrc(&o,0);
+      STBIW_ASSERT(o == out + len);
+   }
+
+   for (frame=0; frame < frame_count; ++frame)
+      stbiw__png_free(options, a.frame_data[frame]);
+   stbiw__png_free(options, a.frame_data);
+   return out;
+}
+
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_apng(char const *filename, int x, int y, int comp, const stbi_write_apng_frame *frames, int frame_count, int stride_bytes, const stbi_write_png_options *options)
+{
+   FILE *f;
+   int len;
+   unsigned char *png = stbi_write_apng_to_mem(frames, frame_count, stride_bytes, x, y, comp, &len, options);
+   if (png == NULL) return 0;
+
+   f = stbiw__fopen(filename, "wb");
+   if (!f) { stbiw__png_free(options, png); return 0; }
+   fwrite(png, 1, len, f);
+   fclose(f);
+   stbiw__png_free(options, png);
+   return 1;
+}
+#endif
+
+STBIWDEF int stbi_write_apng_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const stbi_write_apng_frame *frames, int frame_count, int stride_bytes, const stbi_write_png_options *options)
+{
+   int len;
+   unsigned char *png = stbi_write_apng_to_mem(frames, frame_count, stride_bytes, x, y, comp, &len, options);
+   if (png == NULL) return 0;
+   func(context, png, len);
+   stbiw__png_free(options, png);
+   return 1;
+}
 
 /* ***************************************************************************
  *